@@ -0,0 +1,126 @@
+#pragma once
+
+#include "AtmosphereParameters.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+// ThreadSanitizer does not model std::atomic_thread_fence, so under it SnapshotChannel orders the
+// payload words themselves with release stores and acquire loads. That is also correct, but costs
+// a barrier per word on weakly ordered CPUs.
+#if defined(__SANITIZE_THREAD__)
+#define SNAPSHOT_CHANNEL_ORDERED_WORDS 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define SNAPSHOT_CHANNEL_ORDERED_WORDS 1
+#endif
+#endif
+#ifndef SNAPSHOT_CHANNEL_ORDERED_WORDS
+#define SNAPSHOT_CHANNEL_ORDERED_WORDS 0
+#endif
+
+//! Publishes snapshots of a trivially-copyable T to any number of threads without locks. This is
+//! a seqlock whose payload is held as relaxed atomic words: a reader that overlaps a write sees
+//! the sequence change and copies again, so it never blocks a writer and never returns a torn value.
+template<typename T> class SnapshotChannel
+{
+	static_assert(std::is_trivially_copyable<T>::value, "SnapshotChannel needs a trivially-copyable type");
+
+public:
+	explicit SnapshotChannel(const T& initial = T())
+	{
+		latest = initial;
+		Store(initial);
+	}
+
+	//! Applies update to the latest value and publishes the result, returning its version.
+	//! Writers exclude each other by spinning on the sequence; they only wait for one another.
+	template<typename F> uint64_t Update(F update)
+	{
+		// An odd sequence means a write is in progress.
+		uint64_t s = sequence.load(std::memory_order_relaxed);
+		while ((s & 1) != 0 || !sequence.compare_exchange_weak(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed))
+		{
+			std::this_thread::yield();
+			s = sequence.load(std::memory_order_relaxed);
+		}
+#if !SNAPSHOT_CHANNEL_ORDERED_WORDS
+		std::atomic_thread_fence(std::memory_order_release);
+#endif
+		update(latest);
+		Store(latest);
+		sequence.store(s + 2, std::memory_order_release);
+		return (s + 2) / 2;
+	}
+	uint64_t Publish(const T& value)
+	{
+		return Update([&value](T& v) { v = value; });
+	}
+
+	//! Copies out a consistent snapshot and returns its version, which goes up by one per publish.
+	uint64_t Read(T& value) const
+	{
+		for (;;)
+		{
+			uint64_t s = sequence.load(std::memory_order_acquire);
+			if ((s & 1) == 0)
+			{
+				uint32_t copy[WordCount];
+				for (size_t i = 0; i < WordCount; i++)
+					copy[i] = words[i].load(PayloadLoadOrder);
+#if !SNAPSHOT_CHANNEL_ORDERED_WORDS
+				std::atomic_thread_fence(std::memory_order_acquire);
+#endif
+				if (sequence.load(std::memory_order_relaxed) == s)
+				{
+					memcpy(&value, copy, sizeof(T));
+					return s / 2;
+				}
+			}
+			std::this_thread::yield();
+		}
+	}
+	T Read() const
+	{
+		T value;
+		Read(value);
+		return value;
+	}
+	uint64_t GetVersion() const
+	{
+		return sequence.load(std::memory_order_acquire) / 2;
+	}
+
+private:
+	static const size_t WordCount = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+	static const std::memory_order PayloadLoadOrder = SNAPSHOT_CHANNEL_ORDERED_WORDS ? std::memory_order_acquire : std::memory_order_relaxed;
+	static const std::memory_order PayloadStoreOrder = SNAPSHOT_CHANNEL_ORDERED_WORDS ? std::memory_order_release : std::memory_order_relaxed;
+
+	void Store(const T& value)
+	{
+		uint32_t copy[WordCount] = {};
+		memcpy(copy, &value, sizeof(T));
+		for (size_t i = 0; i < WordCount; i++)
+			words[i].store(copy[i], PayloadStoreOrder);
+	}
+
+	std::atomic<uint64_t> sequence{ 0 };
+	std::atomic<uint32_t> words[WordCount];
+	T latest;	// Only touched by the writer holding the sequence.
+};
+
+//! What the UI edits: the atmosphere, whose LUTs must be re-baked when it changes, and the view of
+//! it, which only changes the constants the visualisation reads.
+struct AtmosphereState
+{
+	AtmosphereParameters parameters;
+	//! Goes up whenever parameters changes; a bake records the value it was made from.
+	uint64_t parametersVersion = 0;
+	float mu_s = 0.5f;
+	float height = 0.f;
+};
+
+typedef SnapshotChannel<AtmosphereState> AtmosphereChannel;
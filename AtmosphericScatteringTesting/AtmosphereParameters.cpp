@@ -0,0 +1,191 @@
+#include "AtmosphereParameters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+static const double PI_D = 3.1415926535897932384626433832795;
+
+float DensityLayer::Density(float altitude) const
+{
+	float density = expTerm * std::exp(expScale * altitude) + linearTerm * altitude + constantTerm;
+	return std::min(std::max(density, 0.f), 1.f);
+}
+
+static void CheckTableSize(int size, int minimum, const char* name)
+{
+	if (size < minimum)
+		throw std::invalid_argument(std::string("LutDimensions::") + name + " must be at least " + std::to_string(minimum));
+}
+
+DerivedAtmosphereConstants MakeDerivedConstants(const AtmosphereParameters& p, const LutDimensions& dims)
+{
+	// Every r in the tables lies in [bottomRadius,topRadius] and every cosine in [-1,1]; beyond
+	// that the mappings divide by H, by (H - thickness) and by A, so all three must be positive.
+	if (!(p.bottomRadius > 0.f) || !std::isfinite(p.topRadius) || !(p.topRadius > p.bottomRadius))
+		throw std::invalid_argument("AtmosphereParameters: need 0 < bottomRadius < topRadius");
+	if (!(p.mu_s_min >= -1.f && p.mu_s_min < 1.f))
+		throw std::invalid_argument("AtmosphereParameters: mu_s_min must be in [-1,1)");
+	// Texel-centre mappings divide by (1 - 1/size), and the scattering nu coordinate by (size - 1).
+	CheckTableSize(dims.transmittanceWidth, 2, "transmittanceWidth");
+	CheckTableSize(dims.transmittanceHeight, 2, "transmittanceHeight");
+	CheckTableSize(dims.irradianceWidth, 2, "irradianceWidth");
+	CheckTableSize(dims.irradianceHeight, 2, "irradianceHeight");
+	CheckTableSize(dims.scatteringNu, 2, "scatteringNu");
+	CheckTableSize(dims.scatteringMuS, 2, "scatteringMuS");
+	CheckTableSize(dims.scatteringMu, 4, "scatteringMu");
+	CheckTableSize(dims.scatteringR, 2, "scatteringR");
+	CheckTableSize(dims.transferWidth, 2, "transferWidth");
+	CheckTableSize(dims.transferHeight, 2, "transferHeight");
+	if (dims.scatteringMu % 2 != 0)
+		throw std::invalid_argument("LutDimensions::scatteringMu must be even");
+
+	// Work in double: H is the difference of two squares of ~6e6.
+	double bottom = p.bottomRadius;
+	double top = p.topRadius;
+	double H = std::sqrt(top * top - bottom * bottom);
+	double thickness = top - bottom;
+	// DistanceToTopAtmosphereBoundary(bottomRadius, mu_s_min).
+	double D = -bottom * p.mu_s_min + std::sqrt(bottom * bottom * (double(p.mu_s_min) * p.mu_s_min - 1.0) + top * top);
+
+	DerivedAtmosphereConstants c;
+	c.bottomRadiusSq = float(bottom * bottom);
+	c.topRadiusSq = float(top * top);
+	c.horizonDistance = float(H);
+	c.invHorizonDistance = float(1.0 / H);
+	c.thickness = float(thickness);
+	c.invMuSDistanceRange = float(1.0 / (H - thickness));
+	c.muSMinDistance = float(D);
+	c.muSMinParameter = float((D - thickness) / (H - thickness));
+	c.invTransmittanceSize[0] = 1.f / float(dims.transmittanceWidth);
+	c.invTransmittanceSize[1] = 1.f / float(dims.transmittanceHeight);
+	c.invIrradianceSize[0] = 1.f / float(dims.irradianceWidth);
+	c.invIrradianceSize[1] = 1.f / float(dims.irradianceHeight);
+	c.invScatteringSize[0] = 1.f / float(dims.scatteringNu);
+	c.invScatteringSize[1] = 1.f / float(dims.scatteringMuS);
+	c.invScatteringSize[2] = 1.f / float(dims.scatteringMu / 2);
+	c.invScatteringSize[3] = 1.f / float(dims.scatteringR);
+	c.invTransferSize[0] = 1.f / float(dims.transferWidth);
+	c.invTransferSize[1] = 1.f / float(dims.transferHeight);
+	return c;
+}
+
+float rayleigh_approx(float l)
+{
+	static double N = 2.545e-14;
+	static double n = 1.000293;
+
+	const double pn = 0.0035;
+
+	double result = 0;
+
+	result = pow(2.0 * PI_D, 3.0);
+	result *= pow(n * n - 1.0, 2.0);
+	result /= (3.0 * N * pow(l, 4.0));
+	result *= (6.0 + 3.0 * pn);
+	result /= (6.0 - 7.0 * pn);
+	return float(result);
+}
+
+float mie_approx(float l)
+{
+	double result = 0;
+
+	double lambda = static_cast<double>(l) * 1e-3;  // micro-meters
+	result = pow(lambda, -0.0);
+	result *= 5.328e-3 / 1200.0;
+
+	return float(result);
+}
+
+// The Mie extinction model below is proportional to K(lambda) * lambda^(2-nu), for Junge exponent nu.
+static const double JUNGE_NU = 4.0;
+
+static double Lerp3(double lambda, const double lambdas[3], const double values[3])
+{
+	if (lambda <= lambdas[0])
+		return values[0];
+	if (lambda >= lambdas[2])
+		return values[2];
+	int i = lambda < lambdas[1] ? 0 : 1;
+	double t = (lambda - lambdas[i]) / (lambdas[i + 1] - lambdas[i]);
+	return values[i] + t * (values[i + 1] - values[i]);
+}
+
+static double MieExtinctionShape(double lambda)
+{
+	static const double lambdas[3] = { 440.0, 550.0, 680.0 };
+	static const double K[3] = { 0.6691485, 0.673323, 0.68455 };
+	return Lerp3(lambda, lambdas, K) * pow(lambda, 2.0 - JUNGE_NU);
+}
+
+void GetSpectralCoefficients(const AtmosphereParameters& p, float lambda, float& rayleighScattering, float& mieScattering, float& mieExtinction, float& absorptionExtinction)
+{
+	const float green = 550.f;
+	rayleighScattering = p.rayleighScattering[1] * rayleigh_approx(lambda) / rayleigh_approx(green);
+	mieScattering = p.mieScattering[1] * mie_approx(lambda) / mie_approx(green);
+	mieExtinction = float(p.mieExtinction[1] * MieExtinctionShape(lambda) / MieExtinctionShape(green));
+	// No model for absorption: interpolate between the blue, green and red coefficients.
+	static const double lambdas[3] = { 440.0, 550.0, 630.0 };
+	const double absorption[3] = { p.absorptionExtinction[2], p.absorptionExtinction[1], p.absorptionExtinction[0] };
+	absorptionExtinction = float(Lerp3(lambda, lambdas, absorption));
+}
+
+AtmosphereParameters MakeEarthAtmosphere()
+{
+	AtmosphereParameters p;
+	p.topRadius = 6420000.f;
+	p.bottomRadius = 6360000.f;
+	p.mu_s_min = -0.2f;
+
+	p.rayleighDensity.expTerm = 1.f;
+	p.rayleighDensity.expScale = -1.f / 8000.f;
+	p.rayleighDensity.linearTerm = 0.f;
+	p.rayleighDensity.constantTerm = 0.f;
+
+	const float lambdas[3] = { 630.f, 550.f, 440.f };
+	for (int i = 0; i < 3; i++)
+	{
+		p.rayleighScattering[i] = rayleigh_approx(lambdas[i]) * 0.001f;
+		p.mieScattering[i] = mie_approx(lambdas[i]);
+	}
+
+	p.mieDensity.expTerm = 1.f;
+	p.mieDensity.expScale = -1.f / 1200.f;
+	p.mieDensity.linearTerm = 0.f;
+	p.mieDensity.constantTerm = 0.f;
+
+	double haze = 1.f;
+	double nu = JUNGE_NU;
+	double T = (1.0 + haze);
+	double c = (0.6544 * T - 0.6510) * 1e-16;
+	if (haze > 1.0f)
+		c /= haze;
+	if (c < 0.0)
+		c = 0.0;
+	p.mieExtinction[0] = (float)(0.434 * c * PI_D * pow(2.0 * PI_D / (680.f * 1e-9), nu - 2) * 0.68455) * 0.001f;
+	p.mieExtinction[1] = (float)(0.434 * c * PI_D * pow(2.0 * PI_D / (550.f * 1e-9), nu - 2) * 0.673323) * 0.001f;
+	p.mieExtinction[2] = (float)(0.434 * c * PI_D * pow(2.0 * PI_D / (440.f * 1e-9), nu - 2) * 0.6691485) * 0.001f;
+	p.miePhaseFunction = 0.8f;
+
+	p.absorptionDensity.expTerm = 0.f;
+	p.absorptionDensity.expScale = 0.f;
+	p.absorptionDensity.linearTerm = 1.f / 15000.f;
+	p.absorptionDensity.constantTerm = -2.f / 3.f;
+	// Ozone is left out for now: absorptionExtinction stays zero.
+	//(300.0 * 2.687e20 / 15000.0) * vec3(1.582000e-26, 3.500000e-25, 1.209000e-25);
+
+	p.solarIrradiance = 1.5f;
+	p.groundAlbedo = 0.1f;
+	p.scatteringOrders = 2;
+	return p;
+}
+
+AtmosphereParameters MakeHazyAtmosphere()
+{
+	AtmosphereParameters p = MakeEarthAtmosphere();
+	p.mieDensity.expScale = -1.f / 2400.f;
+	p.multipleScatteringMethod = MultipleScatteringMethod::TRANSFER_LUT;
+	return p;
+}
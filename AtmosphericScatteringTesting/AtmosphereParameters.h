@@ -0,0 +1,110 @@
+#pragma once
+
+//! Density profile of one atmospheric constituent, as in GetLayerDensity() in atmospheric_testing.sl.
+struct DensityLayer
+{
+	float expTerm = 0.f;
+	float expScale = 0.f;
+	float linearTerm = 0.f;
+	float constantTerm = 0.f;
+
+	float Density(float altitude) const;
+};
+
+//! How the bake accounts for light scattered more than once.
+enum class MultipleScatteringMethod
+{
+	//! One density and one integration pass per order, up to AtmosphereParameters::scatteringOrders.
+	ITERATIVE_ORDERS,
+	//! All orders at once from a small (r,mu_s) transfer table, assuming the light scattered
+	//! more than once is isotropic, as in Hillaire, "A Scalable and Production Ready Sky and
+	//! Atmosphere Rendering Technique", EGSR 2020.
+	TRANSFER_LUT
+};
+
+//! The physical description of an atmosphere, shared by the GPU constant buffer and the CPU engine.
+//! Distances are in metres; the scattering and extinction coefficients are per metre at the
+//! red, green and blue wavelengths.
+struct AtmosphereParameters
+{
+	float bottomRadius = 6360000.f;
+	float topRadius = 6420000.f;
+	float mu_s_min = -0.2f;
+
+	DensityLayer rayleighDensity;
+	DensityLayer mieDensity;
+	DensityLayer absorptionDensity;
+
+	float rayleighScattering[3] = { 0.f, 0.f, 0.f };
+	float mieScattering[3] = { 0.f, 0.f, 0.f };
+	float mieExtinction[3] = { 0.f, 0.f, 0.f };
+	float absorptionExtinction[3] = { 0.f, 0.f, 0.f };
+
+	float miePhaseFunction = 0.8f;		// Asymmetry parameter g of the Cornette-Shanks phase function.
+	float solarIrradiance = 1.5f;
+	float sunAngularRadius = 0.05f;
+	float groundAlbedo = 0.1f;
+	int scatteringOrders = 2;
+	MultipleScatteringMethod multipleScatteringMethod = MultipleScatteringMethod::ITERATIVE_ORDERS;
+};
+
+//! Resolution of the precomputed tables. The 4D scattering table is packed into a 3D texture
+//! with nu and mu_s sharing the x axis, as in atmospheric_scattering.sfx.
+struct LutDimensions
+{
+	int transmittanceWidth = 256;
+	int transmittanceHeight = 256;
+	int irradianceWidth = 256;
+	int irradianceHeight = 256;
+	int scatteringNu = 8;
+	int scatteringMuS = 32;
+	int scatteringMu = 128;
+	int scatteringR = 32;
+	// The multiple scattering transfer table, mu_s by r; see MultipleScatteringMethod::TRANSFER_LUT.
+	int transferWidth = 32;
+	int transferHeight = 32;
+
+	int ScatteringWidth() const
+	{
+		return scatteringNu * scatteringMuS;
+	}
+};
+
+//! The terms of the table mappings in atmospheric_testing.sl that depend only on the atmosphere
+//! and the table sizes, computed once per atmosphere instead of once per sample.
+struct DerivedAtmosphereConstants
+{
+	float bottomRadiusSq = 0.f;
+	float topRadiusSq = 0.f;
+	float horizonDistance = 0.f;		// H: distance to the top boundary along a horizontal ray at ground level.
+	float invHorizonDistance = 0.f;
+	float thickness = 0.f;				// topRadius - bottomRadius: d_min of the mu_s mapping.
+	float invMuSDistanceRange = 0.f;	// 1 / (H - thickness): the mu_s mapping's 1 / (d_max - d_min).
+	float muSMinDistance = 0.f;			// D: distance to the top boundary from the ground towards mu_s_min.
+	float muSMinParameter = 0.f;		// A: the mu_s mapping's a at mu_s_min.
+
+	// Reciprocal table sizes. The scattering mu entry is for half the table, as each half maps
+	// the rays that do or don't hit the ground.
+	float invTransmittanceSize[2] = { 0.f, 0.f };
+	float invIrradianceSize[2] = { 0.f, 0.f };
+	float invScatteringSize[4] = { 0.f, 0.f, 0.f, 0.f };	// nu, mu_s, mu / 2, r.
+	float invTransferSize[2] = { 0.f, 0.f };
+};
+
+//! Validates p and dims against the ranges the mappings assume (the commented-out asserts in
+//! atmospheric_testing.sl), throwing std::invalid_argument if they are out of range.
+DerivedAtmosphereConstants MakeDerivedConstants(const AtmosphereParameters& p, const LutDimensions& dims);
+
+float rayleigh_approx(float l);
+float mie_approx(float l);
+
+//! Scattering and extinction coefficients at one wavelength in nm, for the spectral bake. The
+//! wavelength dependence comes from the same models MakeEarthAtmosphere() uses, scaled to match
+//! p's coefficients at the green wavelength, so edits to p carry over to the spectral bake.
+void GetSpectralCoefficients(const AtmosphereParameters& p, float lambda, float& rayleighScattering, float& mieScattering, float& mieExtinction, float& absorptionExtinction);
+
+//! The atmosphere Test_External bakes: exponential Rayleigh and Mie layers and a (disabled) ozone tent.
+AtmosphereParameters MakeEarthAtmosphere();
+//! MakeEarthAtmosphere() with a deeper Mie layer. Being weather that changes at run time, it
+//! uses the transfer table rather than iterating over scattering orders.
+AtmosphereParameters MakeHazyAtmosphere();
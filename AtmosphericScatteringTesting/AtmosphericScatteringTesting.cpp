@@ -34,6 +34,13 @@
 #include "Platform/Math/Pi.h"
 
 #include "Shaders/atmospheric_transmittance_constants.sl"
+#include "AtmosphereChannel.h"
+#include "AtmosphereParameters.h"
+#include "BakeScheduler.h"
+#include "LutDeltaUpload.h"
+#include "LutTexturePool.h"
+#include "MappingBenchmark.h"
+#include "ProgressiveBake.h"
 
 #ifdef _MSC_VER
 #include "Platform/Windows/VisualStudioDebugOutput.h"
@@ -46,6 +53,10 @@ using namespace simul;
 #include <SDKDDKVer.h>
 #include <shellapi.h>
 #include <random>
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cwchar>
 
 #define STRING_OF_MACRO1(x) #x
 #define STRING_OF_MACRO(x) STRING_OF_MACRO1(x)
@@ -60,6 +71,25 @@ crossplatform::DisplaySurfaceManager displaySurfaceManager;
 
 platform::core::CommandLineParams commandLineParams;
 
+//! The number given by a "name=value" argument, or fallback if there is none. CommandLineParams
+//! only answers whether a flag is present, so settings are read from the raw command line.
+static double GetCommandLineValue(const wchar_t* name, double fallback)
+{
+	int argCount = 0;
+	wchar_t** argList = CommandLineToArgvW(GetCommandLineW(), &argCount);
+	if (!argList)
+		return fallback;
+	const size_t nameLength = wcslen(name);
+	double value = fallback;
+	for (int i = 1; i < argCount; i++)
+	{
+		if (wcsncmp(argList[i], name, nameLength) == 0 && argList[i][nameLength] == L'=')
+			value = wcstod(argList[i] + nameLength + 1, nullptr);
+	}
+	LocalFree(argList);
+	return value;
+}
+
 crossplatform::ConstantBuffer<cbAtmosphere>	atmosphereConstants;
 
 crossplatform::Texture* transmittanceTexture;
@@ -76,8 +106,16 @@ wchar_t wszWindowClass[] = L"AtmosphericScatteringTest";
 int kOverrideWidth = 1440;
 int kOverrideHeight = 900;
 
-float mu_s = 0.5;
-float height = 0.0;
+// Written by WndProc, read by the renderer and the bakes.
+AtmosphereChannel atmosphereChannel;
+
+//! Where Test_External's LUTs come from.
+enum class LutSource
+{
+	GPU_BAKE,				// The precompute shaders, stalling the frame on each change.
+	PROGRESSIVE_CPU_BAKE,	// "progressive_bake": see ProgressiveBake.
+	DELTA_CPU_BAKE			// "delta_upload": full CPU bakes, uploading only the bricks that changed.
+};
 
 enum class TestType
 {
@@ -91,32 +129,154 @@ enum class TestType
 	EXTERNAL
 };
 
-static float rayleigh_approx(float l)
-{
-	static double N = 2.545e-14;
-	static double n = 1.000293;
+//! Threads per group, in x and y, of the scattering compute shaders: BLOCK_X and BLOCK_Y in
+//! atmospheric_scattering.sfx.
+static const int ScatteringBlockSize = 16;
 
-	const double pn = 0.0035;
+//! Copies an atmosphere description, and the mapping terms derived from it for tables of the given
+//! size, into the constant buffer used by the precompute shaders.
+static void SetAtmosphereConstants(cbAtmosphere& c, const AtmosphereParameters& p, const LutDimensions& dims)
+{
+	c.g_topRadius = p.topRadius;
+	c.g_bottomRadius = p.bottomRadius;
+	c.g_mu_s_min = p.mu_s_min;
+
+	c.g_rayleighExpTerm = p.rayleighDensity.expTerm;
+	c.g_rayleighExpScale = p.rayleighDensity.expScale;
+	c.g_rayleighLinearTerm = p.rayleighDensity.linearTerm;
+	c.g_rayleighConstantTerm = p.rayleighDensity.constantTerm;
+	c.g_rayleighScattering = vec3(p.rayleighScattering[0], p.rayleighScattering[1], p.rayleighScattering[2]);
+
+	c.g_mieExpTerm = p.mieDensity.expTerm;
+	c.g_mieExpScale = p.mieDensity.expScale;
+	c.g_mieLinearTerm = p.mieDensity.linearTerm;
+	c.g_mieConstantTerm = p.mieDensity.constantTerm;
+	c.g_mieScattering = vec3(p.mieScattering[0], p.mieScattering[1], p.mieScattering[2]);
+	c.g_miePhaseFunction = p.miePhaseFunction;
+	c.g_mieExtinction = vec3(p.mieExtinction[0], p.mieExtinction[1], p.mieExtinction[2]);
+
+	c.g_absorptionExpTerm = p.absorptionDensity.expTerm;
+	c.g_absorptionExpScale = p.absorptionDensity.expScale;
+	c.g_absorptionLinearTerm = p.absorptionDensity.linearTerm;
+	c.g_absorptionConstantTerm = p.absorptionDensity.constantTerm;
+	c.g_absorptionExtinction = vec3(p.absorptionExtinction[0], p.absorptionExtinction[1], p.absorptionExtinction[2]);
+
+	c.g_solarIrradiance = p.solarIrradiance;
+	c.g_groundAlbedo = p.groundAlbedo;
+	c.g_scatteringOrder = float(p.scatteringOrders);
+
+	DerivedAtmosphereConstants derived = MakeDerivedConstants(p, dims);
+	c.g_horizonDistance = derived.horizonDistance;
+	c.g_invHorizonDistance = derived.invHorizonDistance;
+	c.g_atmosphereThickness = derived.thickness;
+	c.g_invMuSDistanceRange = derived.invMuSDistanceRange;
+	c.g_bottomRadiusSq = derived.bottomRadiusSq;
+	c.g_topRadiusSq = derived.topRadiusSq;
+	c.g_muSMinDistance = derived.muSMinDistance;
+	c.g_muSMinParameter = derived.muSMinParameter;
+	c.g_invTransmittanceSize = vec2(derived.invTransmittanceSize[0], derived.invTransmittanceSize[1]);
+	c.g_invIrradianceSize = vec2(derived.invIrradianceSize[0], derived.invIrradianceSize[1]);
+	c.g_invScatteringSize = vec4(derived.invScatteringSize[0], derived.invScatteringSize[1], derived.invScatteringSize[2], derived.invScatteringSize[3]);
+}
 
-	double result = 0;
+//! Bakes the clear and hazy presets on the CPU. The scheduler overlaps the two bakes.
+static void RunCpuBake()
+{
+	LutBufferPool lutBufferPool(commandLineParams("huge_pages"));
+	BakeScheduler scheduler(lutBufferPool);
+	AtmosphereParameters clear = MakeEarthAtmosphere();
+	AtmosphereParameters hazy = MakeHazyAtmosphere();
+	LutDimensions dims;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	BakeScheduler::LutSetFuture clearLuts = scheduler.Submit(clear, dims);
+	BakeScheduler::LutSetFuture hazyLuts = scheduler.Submit(hazy, dims);
+	clearLuts.wait();
+	hazyLuts.wait();
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	LutPoolStats stats = lutBufferPool.GetStats();
+	std::cout << "CPU bake of 2 atmospheres on " << scheduler.GetThreadCount() << " threads: " << seconds << " s, "
+		<< (stats.highWaterBytes >> 20) << " MB high water" << (lutBufferPool.UsesHugePages() ? " in huge pages" : "") << std::endl;
+}
 
-	result = pow(2.0 * SIMUL_PI_D, 3.0);
-	result *= pow(n * n - 1.0, 2.0);
-	result /= (3.0 * N * pow(l, 4.0));
-	result *= (6.0 + 3.0 * pn);
-	result /= (6.0 - 7.0 * pn);
-	return float(result);
+//! Bakes the same atmosphere in each spectral mode and reports the cost relative to the RGB bake.
+static void RunSpectralBakeComparison()
+{
+	LutBufferPool lutBufferPool(commandLineParams("huge_pages"));
+	BakeScheduler scheduler(lutBufferPool);
+	AtmosphereParameters p = MakeEarthAtmosphere();
+	LutDimensions dims;
+
+	const SpectralMode modes[] = { SpectralMode::RGB, SpectralMode::SPECTRAL_8, SpectralMode::SPECTRAL_16 };
+	double rgbSeconds = 0.0;
+	for (SpectralMode mode : modes)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		scheduler.Submit(p, dims, mode).wait();
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		if (mode == SpectralMode::RGB)
+			rgbSeconds = seconds;
+		std::cout << "CPU bake with " << int(mode) << " channels: " << seconds << " s, "
+			<< seconds / rgbSeconds << "x the RGB bake" << std::endl;
+	}
 }
 
-static float mie_approx(float l)
+//! Relative RMS difference and ratio of sums between the RGB channels of two RGBA tables of equal size.
+static void CompareLuts(const CpuLut& lut, const CpuLut& reference, double& rmsError, double& energyRatio)
 {
-	double result = 0;
+	double squaredError = 0.0, squaredReference = 0.0, sum = 0.0, referenceSum = 0.0;
+	size_t texelCount = lut.desc.TexelCount();
+	for (size_t t = 0; t < texelCount; t++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			double a = lut.texels[4 * t + c];
+			double b = reference.texels[4 * t + c];
+			squaredError += (a - b) * (a - b);
+			squaredReference += b * b;
+			sum += a;
+			referenceSum += b;
+		}
+	}
+	rmsError = squaredReference > 0.0 ? std::sqrt(squaredError / squaredReference) : 0.0;
+	energyRatio = referenceSum > 0.0 ? sum / referenceSum : 1.0;
+}
 
-	double lambda = static_cast<double>(l) * 1e-3;  // micro-meters
-	result = pow(lambda, -0.0);
-	result *= 5.328e-3 / 1200.0;
+//! Compares the multiple scattering from the transfer table, and from a few scattering orders, with
+//! many iterated orders, and reports the bake time of each.
+static void RunMultipleScatteringComparison()
+{
+	LutBufferPool lutBufferPool(commandLineParams("huge_pages"));
+	BakeScheduler scheduler(lutBufferPool);
+	LutDimensions dims;
+	auto Bake = [&](const AtmosphereParameters& p, double& seconds)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		std::shared_ptr<CpuLutSet> luts = scheduler.Submit(p, dims).get();
+		seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		return luts;
+	};
 
-	return float(result);
+	const int REFERENCE_ORDERS = 6;
+	AtmosphereParameters p = MakeEarthAtmosphere();
+	p.scatteringOrders = REFERENCE_ORDERS;
+	double seconds = 0.0, rmsError = 0.0, energyRatio = 0.0;
+	std::shared_ptr<CpuLutSet> reference = Bake(p, seconds);
+	std::cout << "Multiple scattering, " << REFERENCE_ORDERS << " orders (reference): " << seconds << " s" << std::endl;
+	for (int orders = 2; orders < REFERENCE_ORDERS; orders++)
+	{
+		p.scatteringOrders = orders;
+		std::shared_ptr<CpuLutSet> luts = Bake(p, seconds);
+		CompareLuts(luts->multipleScattering, reference->multipleScattering, rmsError, energyRatio);
+		std::cout << "Multiple scattering, " << orders << " orders: " << seconds << " s, relative RMS error " << rmsError
+			<< ", energy ratio " << energyRatio << std::endl;
+	}
+	p.multipleScatteringMethod = MultipleScatteringMethod::TRANSFER_LUT;
+	std::shared_ptr<CpuLutSet> luts = Bake(p, seconds);
+	CompareLuts(luts->multipleScattering, reference->multipleScattering, rmsError, energyRatio);
+	std::cout << "Multiple scattering, transfer table: " << seconds << " s, relative RMS error " << rmsError
+		<< ", energy ratio " << energyRatio << std::endl;
 }
 
 class PlatformRenderer : public crossplatform::PlatformRendererInterface
@@ -138,6 +298,17 @@ public:
 	crossplatform::Effect* scatteringEffect = nullptr;
 	crossplatform::ConstantBuffer<SceneConstants>	sceneConstants;
 	crossplatform::ConstantBuffer<CameraConstants>	cameraConstants;
+	LutTexturePool									lutTexturePool;
+	uint64_t										bakedParametersVersion = 0;	// AtmosphereState::parametersVersion of the current LUTs.
+	LutSource										lutSource = LutSource::GPU_BAKE;
+	const double									progressiveBudgetMilliseconds = 2.0;
+	LutBufferPool									lutBufferPool{ commandLineParams("huge_pages") };
+	BakeScheduler									bakeScheduler{ lutBufferPool };
+	ProgressiveBake									progressiveBake{ bakeScheduler, lutTexturePool };
+	LutDeltaUpload									lutDeltaUpload{ lutTexturePool };
+	BakeScheduler::LutSetFuture						pendingDeltaBake;
+	std::shared_ptr<BakeProgress>					pendingDeltaProgress;
+	AtmosphereParameters							pendingDeltaParameters;
 
 	//Scene Objects
 	crossplatform::Camera							camera;
@@ -150,6 +321,16 @@ public:
 	PlatformRenderer(const crossplatform::RenderPlatformType& rpType, const TestType& tType, bool use_debug)
 		:renderPlatformType(rpType), testType(tType), debug(use_debug)
 	{
+		if (commandLineParams("progressive_bake"))
+			lutSource = LutSource::PROGRESSIVE_CPU_BAKE;
+		else if (commandLineParams("delta_upload"))
+			lutSource = LutSource::DELTA_CPU_BAKE;
+		// E.g. delta_threshold=0.001 delta_absolute_threshold=1e-6 delta_brick_rows=4.
+		const LutDeltaTracker deltaDefaults;
+		lutDeltaUpload.SetThresholds(float(GetCommandLineValue(L"delta_threshold", deltaDefaults.relativeThreshold)),
+			float(GetCommandLineValue(L"delta_absolute_threshold", deltaDefaults.absoluteThreshold)),
+			int(GetCommandLineValue(L"delta_brick_rows", deltaDefaults.brickRows)));
+
 		//Inital RenderPlatform and RenderDoc
 		//if (debug)
 		crossplatform::RenderDocLoader::Load();
@@ -252,6 +433,8 @@ public:
 
 	~PlatformRenderer()
 	{
+		// Otherwise the scheduler's destructor would wait for the whole bake to run.
+		CancelDeltaBake();
 		delete hdrFramebuffer;
 		delete hdrRenderer;
 		delete depthTexture;
@@ -314,6 +497,10 @@ public:
 		sceneConstants.InvalidateDeviceObjects();
 		cameraConstants.InvalidateDeviceObjects();
 		atmosphereConstants.InvalidateDeviceObjects();
+		ReleaseLuts();
+		lutTexturePool.InvalidateDeviceObjects();
+		// Buffers still held by a cancelled bake come back to the pool later and are kept for reuse.
+		lutBufferPool.Trim();
 		hdrRenderer->InvalidateDeviceObjects();
 		hdrFramebuffer->InvalidateDeviceObjects();
 		renderPlatform->InvalidateDeviceObjects();
@@ -398,20 +585,30 @@ public:
 	{
 		hdrFramebuffer->Clear(deviceContext, 0.00f, 0.31f, 0.57f, 1.00f, reverseDepth ? 0.0f : 1.0f);
 
-		if (!texturesGenerated)
+		AtmosphereState state;
+		atmosphereChannel.Read(state);
+		// Re-bake when the atmosphere has changed since the LUTs were made, but not for view changes.
+		// The CPU bakes are restarted instead, and keep their old LUTs in use until new ones are ready.
+		if (lutSource == LutSource::PROGRESSIVE_CPU_BAKE)
+			UpdateProgressiveBake(deviceContext, state);
+		else if (lutSource == LutSource::DELTA_CPU_BAKE)
+			UpdateDeltaUpload(deviceContext, state);
+		else if (texturesGenerated && state.parametersVersion != bakedParametersVersion)
+			ReleaseLuts();
+		if (lutSource == LutSource::GPU_BAKE && !texturesGenerated)
 		{
-			transmittanceTexture = renderPlatform->CreateTexture();
-			directIrradianceTexture = renderPlatform->CreateTexture();
-			singleScatteringTexture = renderPlatform->CreateTexture();
-			multipleScatteringTexture = renderPlatform->CreateTexture();
-			scatteringDensityTexture = renderPlatform->CreateTexture();
-			transmittanceTexture->ensureTexture2DSizeAndFormat(renderPlatform, 256, 256, 1, crossplatform::PixelFormat::RGBA_32_FLOAT, false, true, false, 1, 0, false, vec4(0.0, 0.0, 0.0, 0.0));
-			directIrradianceTexture->ensureTexture2DSizeAndFormat(renderPlatform, 256, 256, 1, crossplatform::PixelFormat::RGBA_32_FLOAT, false, true, false, 1, 0, false, vec4(0.0, 0.0, 0.0, 0.0));
-			singleScatteringTexture->ensureTexture3DSizeAndFormat(renderPlatform, 256, 128, 32, crossplatform::PixelFormat::RGBA_32_FLOAT, true, 1, false);
+			// LUT storage comes from the pool, so a re-bake at the same size reuses the previous textures.
+			const LutDimensions lutDims;
+			const LutTextureDesc transmittanceDesc = LutTexturePool::Texture2D(lutDims.transmittanceWidth, lutDims.transmittanceHeight, crossplatform::PixelFormat::RGBA_32_FLOAT);
+			const LutTextureDesc irradianceDesc = LutTexturePool::Texture2D(lutDims.irradianceWidth, lutDims.irradianceHeight, crossplatform::PixelFormat::RGBA_32_FLOAT);
+			const LutTextureDesc scatteringDesc = LutTexturePool::Texture3D(lutDims.ScatteringWidth(), lutDims.scatteringMu, lutDims.scatteringR, crossplatform::PixelFormat::RGBA_32_FLOAT);
+			transmittanceTexture = lutTexturePool.Acquire(renderPlatform, transmittanceDesc);
+			directIrradianceTexture = lutTexturePool.Acquire(renderPlatform, irradianceDesc);
+			singleScatteringTexture = lutTexturePool.Acquire(renderPlatform, scatteringDesc);
 			renderPlatform->ClearTexture(deviceContext, singleScatteringTexture, vec4(1.0, 0.0, 1.0, 0.0));
-			multipleScatteringTexture->ensureTexture3DSizeAndFormat(renderPlatform, 256, 128, 32, crossplatform::PixelFormat::RGBA_32_FLOAT, true, 1, false);
+			multipleScatteringTexture = lutTexturePool.Acquire(renderPlatform, scatteringDesc);
 			renderPlatform->ClearTexture(deviceContext, multipleScatteringTexture, vec4(0.0, 0.0, 0.0, 0.0));
-			scatteringDensityTexture->ensureTexture3DSizeAndFormat(renderPlatform, 256, 128, 32, crossplatform::PixelFormat::RGBA_32_FLOAT, true, 1, false);
+			scatteringDensityTexture = lutTexturePool.Acquire(renderPlatform, scatteringDesc);
 			renderPlatform->ClearTexture(deviceContext, scatteringDensityTexture, vec4(0.0, 0.0, 0.0, 0.0));
 
 			//crossplatform::Effect* transmittance = renderPlatform->CreateEffect("atmospheric_transmittance");
@@ -424,54 +621,11 @@ public:
 			atmosphereConstants.LinkToEffect(transmittanceEffect, "cbAtmosphere");
 			atmosphereConstants.LinkToEffect(scatteringEffect, "cbAtmosphere");
 
-			atmosphereConstants.g_topRadius = 6420000.0;
-			atmosphereConstants.g_bottomRadius = 6360000.0;
-			atmosphereConstants.g_mu_s_min = -0.2;
-
-			atmosphereConstants.g_rayleighExpTerm = 1.f;
-			atmosphereConstants.g_rayleighExpScale = -1.f / 8000.f;
-			atmosphereConstants.g_rayleighLinearTerm = 0.f;
-			atmosphereConstants.g_rayleighConstantTerm = 0.f;
-
-			atmosphereConstants.g_rayleighScattering = vec3(rayleigh_approx(630), rayleigh_approx(550), rayleigh_approx(440)) * 0.001f;
-			atmosphereConstants.g_rayleighDensity;
-
-			atmosphereConstants.g_mieExpTerm = 1.f;
-			atmosphereConstants.g_mieExpScale = -1.f / 1200.f;
-			atmosphereConstants.g_mieLinearTerm = 0.f;
-			atmosphereConstants.g_mieConstantTerm = 0.f;
-
-			double haze = 1.f;
-			double nu = 4.0;
-			double T = (1.0 + haze);
-			double c = (0.6544 * T - 0.6510) * 1e-16;
-			if (haze > 1.0f)
-				c /= haze;
-			if (c < 0.0)
-				c = 0.0;
-			vec3 Mie;
-			Mie.x = (float)(0.434 * c * SIMUL_PI_D * pow(2.0 * SIMUL_PI_D / (680.f * 1e-9), nu - 2) * 0.68455);
-			Mie.y = (float)(0.434 * c * SIMUL_PI_D * pow(2.0 * SIMUL_PI_D / (550.f * 1e-9), nu - 2) * 0.673323);
-			Mie.z = (float)(0.434 * c * SIMUL_PI_D * pow(2.0 * SIMUL_PI_D / (440.f * 1e-9), nu - 2) * 0.6691485);
-
-			atmosphereConstants.g_mieScattering = vec3(mie_approx(630), mie_approx(550), mie_approx(440));
-			atmosphereConstants.g_miePhaseFunction = 0.8f;
-
-			atmosphereConstants.g_mieExtinction = Mie * 0.001f;
-
-			atmosphereConstants.g_absorptionExpTerm = 0.f;
-			atmosphereConstants.g_absorptionExpScale = 0.f;
-			atmosphereConstants.g_absorptionLinearTerm = 1.f / 15000.f;
-			atmosphereConstants.g_absorptionConstantTerm = -2.f / 3.f;
-
-			//atmosphereConstants.g_absorptionExtinction = (300.0 * 2.687e20 / 15000.0) * vec3(1.582000e-26, 3.500000e-25, 1.209000e-25);
-
-			atmosphereConstants.g_solarIrradiance = 1.5;
-			atmosphereConstants.g_groundAlbedo = 0.1;
-			atmosphereConstants.g_scatteringOrder = 2;
-
-			atmosphereConstants.g_mu_s = mu_s;
-			atmosphereConstants.g_height = height;
+			SetAtmosphereConstants(atmosphereConstants, state.parameters, lutDims);
+			const int scatteringGroupsX = (lutDims.ScatteringWidth() + ScatteringBlockSize - 1) / ScatteringBlockSize;
+			const int scatteringGroupsY = (lutDims.scatteringMu + ScatteringBlockSize - 1) / ScatteringBlockSize;
+			atmosphereConstants.g_mu_s = state.mu_s;
+			atmosphereConstants.g_height = state.height;
 
 			effect->SetConstantBuffer(deviceContext, &atmosphereConstants);
 
@@ -494,39 +648,61 @@ public:
 			scatteringEffect->Apply(deviceContext, precompute_single_scattering, 0);
 			scatteringEffect->SetUnorderedAccessView(deviceContext, "singleScatteringOutput", singleScatteringTexture);
 			scatteringEffect->SetTexture(deviceContext, "g_Transmittance", transmittanceTexture);
-			renderPlatform->DispatchCompute(deviceContext, 256, 128, 32);
+			renderPlatform->DispatchCompute(deviceContext, scatteringGroupsX, scatteringGroupsY, lutDims.scatteringR);
 			scatteringEffect->Unapply(deviceContext);
 			scatteringEffect->UnbindTextures(deviceContext);
 
-			scatteringEffect->Apply(deviceContext, precompute_scattering_density_texture, 0);
-			scatteringEffect->SetUnorderedAccessView(deviceContext, "scatteringDensityOutput", scatteringDensityTexture);
-			scatteringEffect->SetTexture(deviceContext, "g_Transmittance", transmittanceTexture);
-			scatteringEffect->SetTexture(deviceContext, "g_DirectIrradiance", directIrradianceTexture);
-			scatteringEffect->SetTexture(deviceContext, "g_singleScattering", singleScatteringTexture);
-			scatteringEffect->SetTexture(deviceContext, "g_multipleScattering", multipleScatteringTexture);
-			renderPlatform->DispatchCompute(deviceContext, 256, 128, 32);
-			scatteringEffect->Unapply(deviceContext);
-			scatteringEffect->UnbindTextures(deviceContext);
+			// Each order's density reads the previous order's scattering on its own, so the per-order deltas
+			// ping-pong through pooled textures while each order is also added into multipleScatteringTexture.
+			// For order 2 the density pass reads single scattering, and the cleared sum stands in for the delta.
+			const int scatteringOrders = int(atmosphereConstants.g_scatteringOrder);
+			crossplatform::Texture* previousOrderTexture = multipleScatteringTexture;
+			for (int order = 2; order <= scatteringOrders; order++)
+			{
+				crossplatform::Texture* orderTexture = lutTexturePool.Acquire(renderPlatform, scatteringDesc);
+				atmosphereConstants.g_scatteringOrder = float(order);
+				effect->SetConstantBuffer(deviceContext, &atmosphereConstants);
+
+				scatteringEffect->Apply(deviceContext, precompute_scattering_density_texture, 0);
+				scatteringEffect->SetUnorderedAccessView(deviceContext, "scatteringDensityOutput", scatteringDensityTexture);
+				scatteringEffect->SetTexture(deviceContext, "g_Transmittance", transmittanceTexture);
+				scatteringEffect->SetTexture(deviceContext, "g_DirectIrradiance", directIrradianceTexture);
+				scatteringEffect->SetTexture(deviceContext, "g_singleScattering", singleScatteringTexture);
+				scatteringEffect->SetTexture(deviceContext, "g_multipleScattering", previousOrderTexture);
+				renderPlatform->DispatchCompute(deviceContext, scatteringGroupsX, scatteringGroupsY, lutDims.scatteringR);
+				scatteringEffect->Unapply(deviceContext);
+				scatteringEffect->UnbindTextures(deviceContext);
+
+				scatteringEffect->Apply(deviceContext, precompute_multiple_scattering_texture, 0);
+				scatteringEffect->SetUnorderedAccessView(deviceContext, "multipleScatteringOutput", orderTexture);
+				scatteringEffect->SetUnorderedAccessView(deviceContext, "multipleScatteringSum", multipleScatteringTexture);
+				scatteringEffect->SetTexture(deviceContext, "g_Transmittance", transmittanceTexture);
+				scatteringEffect->SetTexture(deviceContext, "g_singleScattering", singleScatteringTexture);
+				scatteringEffect->SetTexture(deviceContext, "g_scatteringDensityTexture", scatteringDensityTexture);
+				renderPlatform->DispatchCompute(deviceContext, scatteringGroupsX, scatteringGroupsY, lutDims.scatteringR);
+				scatteringEffect->Unapply(deviceContext);
+				scatteringEffect->UnbindTextures(deviceContext);
+
+				if (previousOrderTexture != multipleScatteringTexture)
+					lutTexturePool.Release(previousOrderTexture);
+				previousOrderTexture = orderTexture;
+			}
+			if (previousOrderTexture != multipleScatteringTexture)
+				lutTexturePool.Release(previousOrderTexture);
 
-			scatteringEffect->Apply(deviceContext, precompute_multiple_scattering_texture, 0);
-			scatteringEffect->SetUnorderedAccessView(deviceContext, "multipleScatteringOutput", multipleScatteringTexture);
-			scatteringEffect->SetTexture(deviceContext, "g_Transmittance", transmittanceTexture);
-			scatteringEffect->SetTexture(deviceContext, "g_singleScattering", singleScatteringTexture);
-			scatteringEffect->SetTexture(deviceContext, "g_scatteringDensityTexture", scatteringDensityTexture);
-			renderPlatform->DispatchCompute(deviceContext, 256, 128, 32);
-			scatteringEffect->Unapply(deviceContext);
-			scatteringEffect->UnbindTextures(deviceContext);
+			LutPoolStats lutStats = lutTexturePool.GetStats();
+			std::cout << "LUT texture pool: " << lutStats.allocationCount << " allocations, " << lutStats.reuseCount << " of " << lutStats.acquireCount
+				<< " acquires reused, high water " << (lutStats.highWaterBytes >> 20) << " MB" << std::endl;
 
 			texturesGenerated = true;
+			bakedParametersVersion = state.parametersVersion;
 		}
-		if (mu_s > 1.0)
-			mu_s = 1.0;
-		if (mu_s < 0.0)
-			mu_s = 0.0;
-
+		// A CPU bake has nothing to show until its first LUTs are uploaded.
+		if (!directIrradianceTexture)
+			return;
 
-		atmosphereConstants.g_height = height;
-		atmosphereConstants.g_mu_s = mu_s;
+		atmosphereConstants.g_height = state.height;
+		atmosphereConstants.g_mu_s = state.mu_s;
 		
 		effect->SetConstantBuffer(deviceContext, &atmosphereConstants);		/*
 
@@ -683,9 +859,122 @@ public:
 		scatteringEffect->Unapply(deviceContext);
 		*/
 		renderPlatform->DrawTexture(deviceContext, 0, 0, w, h,directIrradianceTexture, 1.0f, false, 0.45f);
+	}
+
+	//! Restarts the progressive bake when the atmosphere changes, uploads what it can within the
+	//! frame's budget, and points the visualisation at each finer level as it becomes ready.
+	void UpdateProgressiveBake(crossplatform::GraphicsDeviceContext& deviceContext, const AtmosphereState& state)
+	{
+		if (state.parametersVersion != bakedParametersVersion)
+		{
+			progressiveBake.Start(state.parameters, LutDimensions());
+			bakedParametersVersion = state.parametersVersion;
+		}
+		if (!progressiveBake.Update(renderPlatform, deviceContext, progressiveBudgetMilliseconds))
+			return;
+		const LutTextureSet* luts = progressiveBake.GetTextures();
+		transmittanceTexture = luts->transmittance;
+		directIrradianceTexture = luts->directIrradiance;
+		singleScatteringTexture = luts->singleScattering;
+		multipleScatteringTexture = luts->multipleScattering;
+		// The mappings depend on the table sizes, which change from level to level.
+		atmosphereConstants.LinkToEffect(transmittanceEffect, "cbAtmosphere");
+		atmosphereConstants.LinkToEffect(scatteringEffect, "cbAtmosphere");
+		SetAtmosphereConstants(atmosphereConstants, state.parameters, luts->dims);
+		texturesGenerated = true;
+
+		std::cout << "Progressive bake: " << luts->dims.ScatteringWidth() << "x" << luts->dims.scatteringMu << "x" << luts->dims.scatteringR
+			<< " scattering in use, first usable after " << progressiveBake.GetTimeToFirstUsable() * 1000.0 << " ms";
+		if (progressiveBake.IsFinished())
+		{
+			std::cout << ", final after " << progressiveBake.GetTimeToFinal() * 1000.0 << " ms, "
+				<< (progressiveBake.GetUploadedBytes() >> 20) << " MB uploaded";
+		}
+		std::cout << std::endl;
+	}
+
+	//! Skips the remaining jobs of the delta upload's bake, if one is running, and forgets it.
+	void CancelDeltaBake()
+	{
+		if (pendingDeltaProgress)
+			pendingDeltaProgress->Cancel();
+		pendingDeltaProgress.reset();
+		pendingDeltaBake = BakeScheduler::LutSetFuture();
+	}
+
+	//! Bakes the whole atmosphere on the CPU when it changes, cancelling any bake made out of date,
+	//! and sends the textures only the bricks of the result that differ from what they hold.
+	void UpdateDeltaUpload(crossplatform::GraphicsDeviceContext& deviceContext, const AtmosphereState& state)
+	{
+		if (state.parametersVersion != bakedParametersVersion)
+		{
+			CancelDeltaBake();
+			pendingDeltaProgress = std::make_shared<BakeProgress>();
+			pendingDeltaBake = bakeScheduler.Submit(state.parameters, LutDimensions(), SpectralMode::RGB, pendingDeltaProgress);
+			pendingDeltaParameters = state.parameters;
+			bakedParametersVersion = state.parametersVersion;
+		}
+		if (!pendingDeltaBake.valid() || pendingDeltaBake.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+		std::shared_ptr<CpuLutSet> luts;
+		try
+		{
+			luts = pendingDeltaBake.get();
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Delta upload: bake failed: " << e.what() << std::endl;
+		}
+		pendingDeltaBake = BakeScheduler::LutSetFuture();
+		pendingDeltaProgress.reset();
+		if (!luts)
+			return;
 
-		//delete transmittanceTexture;
-		//delete singleScatteringTexture;
+		auto start = std::chrono::high_resolution_clock::now();
+		LutDeltaStats stats = lutDeltaUpload.Upload(renderPlatform, deviceContext, *luts);
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		const LutTextureSet* textures = lutDeltaUpload.GetTextures();
+		transmittanceTexture = textures->transmittance;
+		directIrradianceTexture = textures->directIrradiance;
+		singleScatteringTexture = textures->singleScattering;
+		multipleScatteringTexture = textures->multipleScattering;
+		atmosphereConstants.LinkToEffect(transmittanceEffect, "cbAtmosphere");
+		atmosphereConstants.LinkToEffect(scatteringEffect, "cbAtmosphere");
+		SetAtmosphereConstants(atmosphereConstants, pendingDeltaParameters, textures->dims);
+		texturesGenerated = true;
+
+		std::cout << "Delta upload: " << (stats.uploadedBytes >> 10) << " KB of " << (stats.totalBytes >> 10) << " KB, "
+			<< stats.SkippedFraction() * 100.0 << "% of " << stats.brickCount << " bricks skipped, " << milliseconds << " ms" << std::endl;
+	}
+
+	//! Returns the LUTs to the pool; the next Test_External re-bakes into the same storage.
+	void ReleaseLuts()
+	{
+		if (lutSource != LutSource::GPU_BAKE)
+		{
+			// The textures belong to the CPU bake; forget the version so that it starts again.
+			progressiveBake.Release();
+			CancelDeltaBake();
+			lutDeltaUpload.Release();
+			transmittanceTexture = nullptr;
+			directIrradianceTexture = nullptr;
+			singleScatteringTexture = nullptr;
+			multipleScatteringTexture = nullptr;
+			texturesGenerated = false;
+			bakedParametersVersion = 0;
+			return;
+		}
+		lutTexturePool.Release(transmittanceTexture);
+		lutTexturePool.Release(directIrradianceTexture);
+		lutTexturePool.Release(singleScatteringTexture);
+		lutTexturePool.Release(multipleScatteringTexture);
+		lutTexturePool.Release(scatteringDensityTexture);
+		transmittanceTexture = nullptr;
+		directIrradianceTexture = nullptr;
+		singleScatteringTexture = nullptr;
+		multipleScatteringTexture = nullptr;
+		scatteringDensityTexture = nullptr;
+		texturesGenerated = false;
 	}
 };
 PlatformRenderer* platformRenderer;
@@ -719,15 +1008,28 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			}
 			break;*/
 		case WM_KEYDOWN:
-			if (wParam == VK_DOWN)
+			if (wParam == VK_DOWN || wParam == VK_UP)
 			{
-				mu_s -= 0.01;
-				height -= 500;
+				float step = wParam == VK_UP ? 1.f : -1.f;
+				atmosphereChannel.Update([step](AtmosphereState& s)
+				{
+					s.mu_s += 0.01f * step;
+					if (s.mu_s > 1.f)
+						s.mu_s = 1.f;
+					if (s.mu_s < 0.f)
+						s.mu_s = 0.f;
+					s.height += 500.f * step;
+				});
 			}
-			else if (wParam == VK_UP)
+			else if (wParam == 'H')
 			{
-				mu_s += 0.01;
-				height += 500;
+				// Toggle between the clear and hazy presets; this triggers a re-bake.
+				atmosphereChannel.Update([](AtmosphereState& s)
+				{
+					bool hazy = s.parameters.mieDensity.expScale != MakeEarthAtmosphere().mieDensity.expScale;
+					s.parameters = hazy ? MakeEarthAtmosphere() : MakeHazyAtmosphere();
+					s.parametersVersion++;
+				});
 			}
 			break;
 		/*case WM_COMMAND:
@@ -790,6 +1092,12 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 #endif
 
 	GetCommandLineParams(commandLineParams, argCount, (const wchar_t**)szArgList);
+	{
+		AtmosphereState initialState;
+		initialState.parameters = MakeEarthAtmosphere();
+		initialState.parametersVersion = 1;
+		atmosphereChannel.Publish(initialState);
+	}
 	if (commandLineParams.logfile_utf8.length())
 		debug_buffer.setLogFile(commandLineParams.logfile_utf8.c_str());
 	// Initialize the Window class:
@@ -819,6 +1127,15 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 		UpdateWindow(hWnd);
 	}
 
+	if (commandLineParams("cpu_bake"))
+		RunCpuBake();
+	if (commandLineParams("spectral_bake"))
+		RunSpectralBakeComparison();
+	if (commandLineParams("mapping_benchmark"))
+		RunMappingBenchmark();
+	if (commandLineParams("multiple_scattering_report"))
+		RunMultipleScatteringComparison();
+
 	platformRenderer = new PlatformRenderer(crossplatform::RenderPlatformType::D3D12, TestType::EXTERNAL, commandLineParams("debug"));
 	platformRenderer->OnCreateDevice();
 	displaySurfaceManager.Initialize(platformRenderer->renderPlatform);
@@ -0,0 +1,340 @@
+#include "BakeScheduler.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = std::max(1, int(std::thread::hardware_concurrency()));
+	for (int i = 0; i < threadCount; i++)
+		threads.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	condition.notify_all();
+	for (auto& t : threads)
+		t.join();
+}
+
+void ThreadPool::Enqueue(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(std::move(job));
+	}
+	condition.notify_one();
+}
+
+void ThreadPool::WorkerLoop()
+{
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return quit || !jobs.empty(); });
+			if (jobs.empty())
+				return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		job();
+	}
+}
+
+JobGraph::NodeId JobGraph::AddNode(const std::string& name, std::function<void()> work, const std::vector<NodeId>& dependencies)
+{
+	NodeId id = NodeId(nodes.size());
+	nodes.emplace_back(new Node);
+	Node& node = *nodes.back();
+	node.name = name;
+	node.work = std::move(work);
+	node.pending = int(dependencies.size());
+	for (NodeId d : dependencies)
+		nodes[d]->dependents.push_back(id);
+	return id;
+}
+
+void JobGraph::Run(ThreadPool& pool)
+{
+	// Find the roots before queuing any: once the first is running, its dependents' pending counts
+	// can reach zero while we look, and those nodes are queued by Execute().
+	std::vector<NodeId> roots;
+	for (NodeId id = 0; id < NodeId(nodes.size()); id++)
+	{
+		if (nodes[id]->pending == 0)
+			roots.push_back(id);
+	}
+	std::shared_ptr<JobGraph> self = shared_from_this();
+	for (NodeId id : roots)
+		pool.Enqueue([self, &pool, id]() { self->Execute(pool, id); });
+}
+
+void JobGraph::Execute(ThreadPool& pool, NodeId id)
+{
+	Node& node = *nodes[id];
+	node.work();
+	// Drop the captures now rather than when the graph goes away, as they may hold LUT storage.
+	node.work = nullptr;
+	for (NodeId d : node.dependents)
+	{
+		if (--nodes[d]->pending == 0)
+		{
+			std::shared_ptr<JobGraph> self = shared_from_this();
+			pool.Enqueue([self, &pool, d]() { self->Execute(pool, d); });
+		}
+	}
+	if (++finishedCount == int(nodes.size()))
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		finished.notify_all();
+	}
+}
+
+void JobGraph::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this]() { return IsFinished(); });
+}
+
+bool JobGraph::IsFinished() const
+{
+	return finishedCount == int(nodes.size());
+}
+
+//! The first exception thrown by one of a bake's jobs. Once there is one, the remaining jobs skip
+//! their work and the bake's future rethrows it.
+struct BakeError
+{
+	std::mutex mutex;
+	std::exception_ptr exception;
+	std::atomic<bool> failed{ false };
+
+	void Set(std::exception_ptr e)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!exception)
+			exception = e;
+		failed.store(true, std::memory_order_release);
+	}
+};
+
+CpuLut CpuLutSet::* BakeProgress::GetTable(Table table)
+{
+	switch (table)
+	{
+	case TRANSMITTANCE:
+		return &CpuLutSet::transmittance;
+	case DIRECT_IRRADIANCE:
+		return &CpuLutSet::directIrradiance;
+	case SINGLE_RAYLEIGH_SCATTERING:
+		return &CpuLutSet::singleRayleighScattering;
+	case SINGLE_MIE_SCATTERING:
+		return &CpuLutSet::singleMieScattering;
+	case MULTIPLE_SCATTERING:
+	default:
+		return &CpuLutSet::multipleScattering;
+	}
+}
+
+void BakeProgress::Reset(std::shared_ptr<CpuLutSet> l)
+{
+	luts = l;
+	cancelled.store(false, std::memory_order_relaxed);
+	unitCounts[TRANSMITTANCE] = l->dims.transmittanceHeight;
+	unitCounts[DIRECT_IRRADIANCE] = l->dims.irradianceHeight;
+	unitCounts[SINGLE_RAYLEIGH_SCATTERING] = l->dims.scatteringR;
+	unitCounts[SINGLE_MIE_SCATTERING] = l->dims.scatteringR;
+	unitCounts[MULTIPLE_SCATTERING] = l->dims.scatteringR;
+	for (int t = 0; t < TABLE_COUNT; t++)
+	{
+		finished[t].reset(new std::atomic<bool>[unitCounts[t]]);
+		for (int i = 0; i < unitCounts[t]; i++)
+			finished[t][i].store(false, std::memory_order_relaxed);
+	}
+}
+
+void BakeProgress::MarkFinished(Table table, int begin, int end)
+{
+	for (int i = begin; i < end; i++)
+		finished[table][i].store(true, std::memory_order_release);
+}
+
+BakeScheduler::BakeScheduler(LutBufferPool& pool, int threadCount)
+	: lutBufferPool(pool), threadPool(threadCount)
+{
+}
+
+BakeScheduler::~BakeScheduler()
+{
+	WaitIdle();
+}
+
+BakeScheduler::LutSetFuture BakeScheduler::Submit(const AtmosphereParameters& p, const LutDimensions& dims, SpectralMode mode, std::shared_ptr<BakeProgress> progress)
+{
+	// Callers are on the render thread, so invalid parameters or a failed allocation are reported
+	// through the future like any other bake failure.
+	try
+	{
+		switch (mode)
+		{
+		case SpectralMode::SPECTRAL_8:
+			return Submit<int(SpectralMode::SPECTRAL_8)>(p, dims, progress);
+		case SpectralMode::SPECTRAL_16:
+			return Submit<int(SpectralMode::SPECTRAL_16)>(p, dims, progress);
+		case SpectralMode::RGB:
+		default:
+			return Submit<int(SpectralMode::RGB)>(p, dims, progress);
+		}
+	}
+	catch (...)
+	{
+		std::promise<std::shared_ptr<CpuLutSet>> promise;
+		promise.set_exception(std::current_exception());
+		return promise.get_future().share();
+	}
+}
+
+template<int N> BakeScheduler::LutSetFuture BakeScheduler::Submit(const AtmosphereParameters& p, const LutDimensions& dims, std::shared_ptr<BakeProgress> progress)
+{
+	typedef JobGraph::NodeId NodeId;
+	std::shared_ptr<const CpuAtmosphereEngine<N>> engine = std::make_shared<CpuAtmosphereEngine<N>>(p, dims);
+	LutBufferPool* pool = &lutBufferPool;
+	auto ReleaseLuts = [pool](CpuLutSet* l) { l->Release(*pool); delete l; };
+	std::shared_ptr<CpuLutSet> luts(new CpuLutSet, ReleaseLuts);
+	luts->Acquire(lutBufferPool, dims, N);
+	// The spectral engines bake into N-channel tables, then write the RGBA output from them.
+	std::shared_ptr<CpuLutSet> output = luts;
+	if (N != int(SpectralMode::RGB))
+	{
+		output.reset(new CpuLutSet, ReleaseLuts);
+		output->Acquire(lutBufferPool, dims, 4, false);
+	}
+	if (progress)
+		progress->Reset(output);
+	auto promise = std::make_shared<std::promise<std::shared_ptr<CpuLutSet>>>();
+	LutSetFuture future = promise->get_future().share();
+	std::shared_ptr<BakeError> error = std::make_shared<BakeError>();
+
+	std::shared_ptr<JobGraph> graph = std::make_shared<JobGraph>();
+	// Splits [0,count) into bands, one node each, all depending on every node in deps. The units
+	// of the output tables in finishes are final once a band's work is done.
+	auto AddStage = [&](const std::string& name, int count, std::function<void(CpuLutSet&, int, int)> work, const std::vector<NodeId>& deps
+		, const std::vector<BakeProgress::Table>& finishes = {})
+	{
+		std::vector<NodeId> ids;
+		int bands = std::max(1, std::min(bandsPerStage, count));
+		for (int b = 0; b < bands; b++)
+		{
+			int begin = count * b / bands;
+			int end = count * (b + 1) / bands;
+			ids.push_back(graph->AddNode(name, [work, luts, begin, end, progress, finishes, error]()
+			{
+				if ((progress && progress->IsCancelled()) || error->failed.load(std::memory_order_acquire))
+					return;
+				// A throw must not escape the job: the worker would terminate and the future never be set.
+				try
+				{
+					work(*luts, begin, end);
+				}
+				catch (...)
+				{
+					error->Set(std::current_exception());
+					return;
+				}
+				if (progress)
+				{
+					for (BakeProgress::Table t : finishes)
+						progress->MarkFinished(t, begin, end);
+				}
+			}, deps));
+		}
+		return ids;
+	};
+	auto Join = [](std::vector<NodeId> a, const std::vector<NodeId>& b)
+	{
+		a.insert(a.end(), b.begin(), b.end());
+		return a;
+	};
+
+	// Which output tables a stage completes. The spectral tables are only final once written as RGBA.
+	typedef std::vector<BakeProgress::Table> Tables;
+	auto Finishes = [&](const Tables& tables) { return output == luts ? tables : Tables(); };
+
+	std::vector<NodeId> transmittance = AddStage("transmittance", dims.transmittanceHeight
+		, [engine](CpuLutSet& l, int b, int e) { engine->BakeTransmittance(l, b, e); }, {}, Finishes({ BakeProgress::TRANSMITTANCE }));
+	std::vector<NodeId> directIrradiance = AddStage("direct irradiance", dims.irradianceHeight
+		, [engine](CpuLutSet& l, int b, int e) { engine->BakeDirectIrradiance(l, b, e); }, transmittance, Finishes({ BakeProgress::DIRECT_IRRADIANCE }));
+	// With the transfer table, single scattering adds in every higher order, so nothing follows it.
+	const bool transfer = p.multipleScatteringMethod == MultipleScatteringMethod::TRANSFER_LUT;
+	std::vector<NodeId> singleScatteringDeps = transmittance;
+	if (transfer)
+	{
+		singleScatteringDeps = AddStage("multiple scattering transfer", dims.transferHeight
+			, [engine](CpuLutSet& l, int b, int e) { engine->BakeMultipleScatteringTransfer(l, b, e); }, transmittance);
+	}
+	Tables singleScatteringFinishes = { BakeProgress::SINGLE_RAYLEIGH_SCATTERING, BakeProgress::SINGLE_MIE_SCATTERING };
+	if (transfer || p.scatteringOrders < 2)
+		singleScatteringFinishes.push_back(BakeProgress::MULTIPLE_SCATTERING);
+	std::vector<NodeId> previousOrder = AddStage("single scattering", dims.scatteringR
+		, [engine](CpuLutSet& l, int b, int e) { engine->BakeSingleScattering(l, b, e); }, singleScatteringDeps, Finishes(singleScatteringFinishes));
+	for (int order = 2; !transfer && order <= p.scatteringOrders; order++)
+	{
+		// Density reads all of the previous order's scattering (and the ground irradiance for order 2);
+		// multiple scattering integrates density along the whole ray, so it needs every slice of it.
+		std::vector<NodeId> density = AddStage("scattering density", dims.scatteringR
+			, [engine, order](CpuLutSet& l, int b, int e) { engine->BakeScatteringDensity(l, order, b, e); }
+			, order == 2 ? Join(previousOrder, directIrradiance) : previousOrder);
+		previousOrder = AddStage("multiple scattering", dims.scatteringR
+			, [engine](CpuLutSet& l, int b, int e) { engine->BakeMultipleScattering(l, b, e); }, density
+			, order == p.scatteringOrders ? Finishes({ BakeProgress::MULTIPLE_SCATTERING }) : Tables());
+	}
+	std::vector<NodeId> baked = Join(previousOrder, directIrradiance);
+	if (output != luts)
+	{
+		std::vector<NodeId> written;
+		auto AddWriteRgba = [&](BakeProgress::Table table, int count)
+		{
+			CpuLut CpuLutSet::* lut = BakeProgress::GetTable(table);
+			written = Join(written, AddStage("write rgba", count
+				, [engine, output, lut](CpuLutSet& l, int b, int e) { engine->WriteRgba(l.*lut, (*output).*lut, b, e); }, baked, { table }));
+		};
+		AddWriteRgba(BakeProgress::TRANSMITTANCE, dims.transmittanceHeight);
+		AddWriteRgba(BakeProgress::DIRECT_IRRADIANCE, dims.irradianceHeight);
+		AddWriteRgba(BakeProgress::SINGLE_RAYLEIGH_SCATTERING, dims.scatteringR);
+		AddWriteRgba(BakeProgress::SINGLE_MIE_SCATTERING, dims.scatteringR);
+		AddWriteRgba(BakeProgress::MULTIPLE_SCATTERING, dims.scatteringR);
+		baked = written;
+	}
+	graph->AddNode("finish", [promise, output, error]()
+	{
+		if (error->failed.load(std::memory_order_acquire))
+			promise->set_exception(error->exception);
+		else
+			promise->set_value(output);
+	}, baked);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		graphs.erase(std::remove_if(graphs.begin(), graphs.end(), [](const std::shared_ptr<JobGraph>& g) { return g->IsFinished(); }), graphs.end());
+		graphs.push_back(graph);
+	}
+	graph->Run(threadPool);
+	return future;
+}
+
+void BakeScheduler::WaitIdle()
+{
+	std::vector<std::shared_ptr<JobGraph>> pending;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.swap(graphs);
+	}
+	for (auto& g : pending)
+		g->Wait();
+}
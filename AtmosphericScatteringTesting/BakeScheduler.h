@@ -0,0 +1,160 @@
+#pragma once
+
+#include "CpuAtmosphereEngine.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! A fixed set of worker threads taking jobs from a shared FIFO queue.
+class ThreadPool
+{
+public:
+	//! threadCount 0 means one thread per hardware thread.
+	explicit ThreadPool(int threadCount = 0);
+	~ThreadPool();
+	void Enqueue(std::function<void()> job);
+	int GetThreadCount() const
+	{
+		return int(threads.size());
+	}
+
+private:
+	void WorkerLoop();
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool quit = false;
+};
+
+//! Jobs with explicit dependencies. A node is queued on the pool once every node it depends on
+//! has finished, so independent nodes - including nodes from different graphs sharing one
+//! pool - run concurrently.
+class JobGraph : public std::enable_shared_from_this<JobGraph>
+{
+public:
+	typedef int NodeId;
+
+	//! All dependencies must already have been added. work must not throw.
+	NodeId AddNode(const std::string& name, std::function<void()> work, const std::vector<NodeId>& dependencies = {});
+	//! Queues the nodes that have no dependencies. The graph keeps itself alive until every node has run.
+	//! Nodes may not be added after Run().
+	void Run(ThreadPool& pool);
+	void Wait();
+	bool IsFinished() const;
+
+private:
+	struct Node
+	{
+		std::string name;
+		std::function<void()> work;
+		std::vector<NodeId> dependents;
+		std::atomic<int> pending{ 0 };
+	};
+	void Execute(ThreadPool& pool, NodeId id);
+
+	std::vector<std::unique_ptr<Node>> nodes;
+	std::atomic<int> finishedCount{ 0 };
+	mutable std::mutex mutex;
+	std::condition_variable finished;
+};
+
+//! Which rows or r-slices of each output table of a bake are final, so that they can be used
+//! before the whole bake completes. The bake's jobs mark them; any thread may poll.
+class BakeProgress
+{
+public:
+	//! The tables of a CpuLutSet that are uploaded to the GPU.
+	enum Table
+	{
+		TRANSMITTANCE,
+		DIRECT_IRRADIANCE,
+		SINGLE_RAYLEIGH_SCATTERING,
+		SINGLE_MIE_SCATTERING,
+		MULTIPLE_SCATTERING,
+		TABLE_COUNT
+	};
+	static CpuLut CpuLutSet::* GetTable(Table table);
+
+	//! The LUT set being baked, available once BakeScheduler::Submit() has returned. While the bake
+	//! runs, only the units reported finished may be read.
+	std::shared_ptr<CpuLutSet> GetLuts() const
+	{
+		return luts;
+	}
+	//! Units are rows of the 2D tables and r-slices of the 3D ones.
+	int GetUnitCount(Table table) const
+	{
+		return unitCounts[table];
+	}
+	bool IsFinished(Table table, int unit) const
+	{
+		return finished[table][unit].load(std::memory_order_acquire);
+	}
+	//! Makes the bake's remaining jobs return without doing their work. The bake still completes,
+	//! but the contents of its tables are undefined.
+	void Cancel()
+	{
+		cancelled.store(true, std::memory_order_relaxed);
+	}
+	bool IsCancelled() const
+	{
+		return cancelled.load(std::memory_order_relaxed);
+	}
+
+private:
+	friend class BakeScheduler;
+	void Reset(std::shared_ptr<CpuLutSet> l);
+	void MarkFinished(Table table, int begin, int end);
+
+	std::shared_ptr<CpuLutSet> luts;
+	int unitCounts[TABLE_COUNT] = {};
+	std::unique_ptr<std::atomic<bool>[]> finished[TABLE_COUNT];
+	std::atomic<bool> cancelled{ false };
+};
+
+//! Bakes CPU LUT sets asynchronously. Each stage of each bake is a group of JobGraph nodes over
+//! bands of rows or r-slices, with edges only where one stage reads another's output, so work
+//! from several queued atmospheres overlaps on the shared ThreadPool.
+class BakeScheduler
+{
+public:
+	typedef std::shared_future<std::shared_ptr<CpuLutSet>> LutSetFuture;
+
+	//! The pool must outlive the scheduler and every LUT set it returns.
+	BakeScheduler(LutBufferPool& pool, int threadCount = 0);
+	//! Waits for all outstanding bakes.
+	~BakeScheduler();
+
+	//! Queues a full bake of one atmosphere. Whatever the spectral mode, the resulting LUT set has
+	//! RGBA texels. It returns its storage to the pool when the last reference to it is dropped.
+	//! It does not throw: invalid parameters, a failed allocation, or an exception thrown by any
+	//! stage is rethrown by the future's get().
+	//! If progress is given, it is reset to the new LUT set and then tracks the bake.
+	LutSetFuture Submit(const AtmosphereParameters& p, const LutDimensions& dims, SpectralMode mode = SpectralMode::RGB, std::shared_ptr<BakeProgress> progress = nullptr);
+	void WaitIdle();
+	int GetThreadCount() const
+	{
+		return threadPool.GetThreadCount();
+	}
+
+	//! Number of jobs each stage is split into, at most one per row or r-slice.
+	int bandsPerStage = 8;
+
+private:
+	template<int N> LutSetFuture Submit(const AtmosphereParameters& p, const LutDimensions& dims, std::shared_ptr<BakeProgress> progress);
+
+	LutBufferPool& lutBufferPool;
+	ThreadPool threadPool;
+	std::mutex mutex;
+	std::vector<std::shared_ptr<JobGraph>> graphs;
+};
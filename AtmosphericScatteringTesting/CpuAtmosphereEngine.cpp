@@ -0,0 +1,724 @@
+#include "CpuAtmosphereEngine.h"
+#include "SpectralColour.h"
+
+#include <algorithm>
+#include <cmath>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+static const float PI = 3.14159265f;
+
+static float ClampCosine(float mu)
+{
+	return std::min(std::max(mu, -1.f), 1.f);
+}
+
+static float ClampDistance(float d)
+{
+	return std::max(d, 0.f);
+}
+
+static float SafeSqrt(float a)
+{
+	return std::sqrt(std::max(a, 0.f));
+}
+
+// As in atmospheric_testing.sl, but taking the reciprocal of the texture size.
+static float GetTextureCoordFromUnitRange(float x, float inv_texture_size)
+{
+	return 0.5f * inv_texture_size + x * (1.f - inv_texture_size);
+}
+
+static float GetUnitRangeFromTextureCoord(float u, float inv_texture_size)
+{
+	return (u - 0.5f * inv_texture_size) / (1.f - inv_texture_size);
+}
+
+static float RayleighPhaseFunction(float nu)
+{
+	float k = 3.f / (16.f * PI);
+	return k * (1.f + nu * nu);
+}
+
+static float MiePhaseFunction(float g, float nu)
+{
+	float k = 3.f / (8.f * PI) * (1.f - g * g) / (2.f + g * g);
+	return k * (1.f + nu * nu) / std::pow(1.f + g * g - 2.f * g * nu, 1.5f);
+}
+
+// With AVX, spectral texels are copied a whole register at a time. Copied lane by lane, the
+// compiler builds each 8-lane register from narrower stores to the stack, which defeats
+// store-to-load forwarding; that alone made table lookups in the spectral bakes up to twice as
+// slow as in the RGB one.
+template<int N> static Spectrum<N> LoadTexel(const CpuLut& lut, int x, int y, int z)
+{
+	Spectrum<N> s;
+	const float* t = lut.Texel(x, y, z);
+#if defined(__AVX__)
+	if constexpr (N % 8 == 0)
+	{
+		for (int i = 0; i < N; i += 8)
+			_mm256_store_ps(s.v + i, _mm256_loadu_ps(t + i));
+		return s;
+	}
+#endif
+	for (int i = 0; i < N; i++)
+		s[i] = t[i];
+	return s;
+}
+
+template<int N> static void StoreTexel(CpuLut& lut, int x, int y, int z, const Spectrum<N>& s)
+{
+	float* t = lut.Texel(x, y, z);
+#if defined(__AVX__)
+	if constexpr (N % 8 == 0)
+	{
+		for (int i = 0; i < N; i += 8)
+			_mm256_storeu_ps(t + i, _mm256_load_ps(s.v + i));
+		return;
+	}
+#endif
+	for (int i = 0; i < N; i++)
+		t[i] = s[i];
+}
+
+// Bilinear and trilinear filtering with clamp addressing, i.e. clampSamplerState.
+static void GetFilterTexels(float u, int size, int& i0, int& i1, float& f)
+{
+	float x = u * float(size) - 0.5f;
+	float fl = std::floor(x);
+	f = x - fl;
+	i0 = std::min(std::max(int(fl), 0), size - 1);
+	i1 = std::min(std::max(int(fl) + 1, 0), size - 1);
+}
+
+template<int N> static Spectrum<N> Sample2D(const CpuLut& lut, float u, float v)
+{
+	int x0, x1, y0, y1;
+	float fx, fy;
+	GetFilterTexels(u, lut.desc.width, x0, x1, fx);
+	GetFilterTexels(v, lut.desc.height, y0, y1, fy);
+	Spectrum<N> a = LoadTexel<N>(lut, x0, y0, 0) * (1.f - fx) + LoadTexel<N>(lut, x1, y0, 0) * fx;
+	Spectrum<N> b = LoadTexel<N>(lut, x0, y1, 0) * (1.f - fx) + LoadTexel<N>(lut, x1, y1, 0) * fx;
+	return a * (1.f - fy) + b * fy;
+}
+
+template<int N> static Spectrum<N> Sample3D(const CpuLut& lut, float u, float v, float w)
+{
+	int x0, x1, y0, y1, z0, z1;
+	float fx, fy, fz;
+	GetFilterTexels(u, lut.desc.width, x0, x1, fx);
+	GetFilterTexels(v, lut.desc.height, y0, y1, fy);
+	GetFilterTexels(w, lut.desc.depth, z0, z1, fz);
+	Spectrum<N> a0 = LoadTexel<N>(lut, x0, y0, z0) * (1.f - fx) + LoadTexel<N>(lut, x1, y0, z0) * fx;
+	Spectrum<N> b0 = LoadTexel<N>(lut, x0, y1, z0) * (1.f - fx) + LoadTexel<N>(lut, x1, y1, z0) * fx;
+	Spectrum<N> a1 = LoadTexel<N>(lut, x0, y0, z1) * (1.f - fx) + LoadTexel<N>(lut, x1, y0, z1) * fx;
+	Spectrum<N> b1 = LoadTexel<N>(lut, x0, y1, z1) * (1.f - fx) + LoadTexel<N>(lut, x1, y1, z1) * fx;
+	return (a0 * (1.f - fy) + b0 * fy) * (1.f - fz) + (a1 * (1.f - fy) + b1 * fy) * fz;
+}
+
+static CpuLut AcquireLut(LutBufferPool& pool, int w, int h, int d, int channels)
+{
+	CpuLut lut;
+	lut.desc.width = w;
+	lut.desc.height = h;
+	lut.desc.depth = d;
+	lut.desc.bytesPerTexel = channels * int(sizeof(float));
+	lut.texels = pool.Acquire<float>(lut.desc);
+	return lut;
+}
+
+void CpuLutSet::Acquire(LutBufferPool& pool, const LutDimensions& d, int channels, bool intermediates)
+{
+	dims = d;
+	transmittance = AcquireLut(pool, d.transmittanceWidth, d.transmittanceHeight, 1, channels);
+	directIrradiance = AcquireLut(pool, d.irradianceWidth, d.irradianceHeight, 1, channels);
+	singleRayleighScattering = AcquireLut(pool, d.ScatteringWidth(), d.scatteringMu, d.scatteringR, channels);
+	singleMieScattering = AcquireLut(pool, d.ScatteringWidth(), d.scatteringMu, d.scatteringR, channels);
+	if (intermediates)
+	{
+		scatteringDensity = AcquireLut(pool, d.ScatteringWidth(), d.scatteringMu, d.scatteringR, channels);
+		deltaMultipleScattering = AcquireLut(pool, d.ScatteringWidth(), d.scatteringMu, d.scatteringR, channels);
+		multipleScatteringTransfer = AcquireLut(pool, d.transferWidth, d.transferHeight, 1, channels);
+	}
+	multipleScattering = AcquireLut(pool, d.ScatteringWidth(), d.scatteringMu, d.scatteringR, channels);
+}
+
+void CpuLutSet::Release(LutBufferPool& pool)
+{
+	CpuLut* luts[] = { &transmittance, &directIrradiance, &singleRayleighScattering, &singleMieScattering, &scatteringDensity, &deltaMultipleScattering, &multipleScattering, &multipleScatteringTransfer };
+	for (CpuLut* lut : luts)
+	{
+		pool.Release(lut->texels);
+		lut->texels = nullptr;
+	}
+}
+
+template<int N> CpuAtmosphereEngine<N>::CpuAtmosphereEngine(const AtmosphereParameters& p, const LutDimensions& d)
+	: params(p), dims(d), derived(MakeDerivedConstants(p, d))
+{
+	rayleighScattering = SpectrumN::Zero();
+	mieScattering = SpectrumN::Zero();
+	mieExtinction = SpectrumN::Zero();
+	absorptionExtinction = SpectrumN::Zero();
+	if (N == int(SpectralMode::RGB))
+	{
+		// Lane 3 is padding, left at zero.
+		for (int i = 0; i < 3; i++)
+		{
+			rayleighScattering[i] = p.rayleighScattering[i];
+			mieScattering[i] = p.mieScattering[i];
+			mieExtinction[i] = p.mieExtinction[i];
+			absorptionExtinction[i] = p.absorptionExtinction[i];
+			for (int j = 0; j < N; j++)
+				rgbWeights[i][j] = (i == j) ? 1.f : 0.f;
+		}
+	}
+	else
+	{
+		float lambdas[N];
+		GetSpectralBinWavelengths(N, lambdas);
+		for (int i = 0; i < N; i++)
+			GetSpectralCoefficients(p, lambdas[i], rayleighScattering[i], mieScattering[i], mieExtinction[i], absorptionExtinction[i]);
+		GetSpectralToRgbWeights(N, &rgbWeights[0][0]);
+	}
+}
+
+template<int N> float CpuAtmosphereEngine<N>::DistanceToTopAtmosphereBoundary(float r, float mu) const
+{
+	float discriminant = r * r * (mu * mu - 1.f) + derived.topRadiusSq;
+	return ClampDistance(-r * mu + SafeSqrt(discriminant));
+}
+
+template<int N> float CpuAtmosphereEngine<N>::DistanceToBottomAtmosphereBoundary(float r, float mu) const
+{
+	float discriminant = r * r * (mu * mu - 1.f) + derived.bottomRadiusSq;
+	return ClampDistance(-r * mu - SafeSqrt(discriminant));
+}
+
+template<int N> bool CpuAtmosphereEngine<N>::RayIntersectsGround(float r, float mu) const
+{
+	return mu < 0.f && r * r * (mu * mu - 1.f) + derived.bottomRadiusSq >= 0.f;
+}
+
+template<int N> void CpuAtmosphereEngine<N>::GetTransmittanceTextureUvFromRMu(float r, float mu, float& u, float& v) const
+{
+	// Distance to top atmosphere boundary for a horizontal ray at ground level.
+	float H = derived.horizonDistance;
+	// Distance to the horizon.
+	float rho = SafeSqrt(r * r - derived.bottomRadiusSq);
+	// Distance to the top atmosphere boundary for the ray (r,mu), and its minimum
+	// and maximum values over all mu - obtained for (r,1) and (r,mu_horizon).
+	float d = DistanceToTopAtmosphereBoundary(r, mu);
+	float d_min = params.topRadius - r;
+	float d_max = rho + H;
+	float x_mu = (d - d_min) / (d_max - d_min);
+	float x_r = rho * derived.invHorizonDistance;
+	u = GetTextureCoordFromUnitRange(x_mu, derived.invTransmittanceSize[0]);
+	v = GetTextureCoordFromUnitRange(x_r, derived.invTransmittanceSize[1]);
+}
+
+template<int N> void CpuAtmosphereEngine<N>::GetRMuFromTransmittanceTextureUv(float u, float v, float& r, float& mu) const
+{
+	float x_mu = GetUnitRangeFromTextureCoord(u, derived.invTransmittanceSize[0]);
+	float x_r = GetUnitRangeFromTextureCoord(v, derived.invTransmittanceSize[1]);
+	float H = derived.horizonDistance;
+	float rho = H * x_r;
+	r = std::sqrt(rho * rho + derived.bottomRadiusSq);
+	float d_min = params.topRadius - r;
+	float d_max = rho + H;
+	float d = d_min + x_mu * (d_max - d_min);
+	mu = d == 0.f ? 1.f : (H * H - rho * rho - d * d) / (2.f * r * d);
+	mu = ClampCosine(mu);
+}
+
+template<int N> void CpuAtmosphereEngine<N>::GetScatteringTextureUvwzFromRMuMuSNu(float r, float mu, float mu_s, float nu, bool ray_r_mu_intersects_ground, float uvwz[4]) const
+{
+	// Distance to top atmosphere boundary for a horizontal ray at ground level.
+	float H = derived.horizonDistance;
+	// Distance to the horizon.
+	float rho = SafeSqrt(r * r - derived.bottomRadiusSq);
+	float u_r = GetTextureCoordFromUnitRange(rho * derived.invHorizonDistance, derived.invScatteringSize[3]);
+
+	// Discriminant of the quadratic equation for the intersections of the ray
+	// (r,mu) with the ground (see RayIntersectsGround).
+	float r_mu = r * mu;
+	float discriminant = r_mu * r_mu - r * r + derived.bottomRadiusSq;
+	float u_mu;
+	if (ray_r_mu_intersects_ground)
+	{
+		// Distance to the ground for the ray (r,mu), and its minimum and maximum
+		// values over all mu - obtained for (r,-1) and (r,mu_horizon).
+		float d = -r_mu - SafeSqrt(discriminant);
+		float d_min = r - params.bottomRadius;
+		float d_max = rho;
+		u_mu = 0.5f - 0.5f * GetTextureCoordFromUnitRange(d_max == d_min ? 0.f : (d - d_min) / (d_max - d_min), derived.invScatteringSize[2]);
+	}
+	else
+	{
+		// Distance to the top atmosphere boundary for the ray (r,mu), and its
+		// minimum and maximum values over all mu - obtained for (r,1) and
+		// (r,mu_horizon).
+		float d = -r_mu + SafeSqrt(discriminant + H * H);
+		float d_min = params.topRadius - r;
+		float d_max = rho + H;
+		u_mu = 0.5f + 0.5f * GetTextureCoordFromUnitRange((d - d_min) / (d_max - d_min), derived.invScatteringSize[2]);
+	}
+
+	float d = DistanceToTopAtmosphereBoundary(params.bottomRadius, mu_s);
+	float d_min = derived.thickness;
+	float a = (d - d_min) * derived.invMuSDistanceRange;
+	float A = derived.muSMinParameter;
+	// An ad-hoc function equal to 0 for mu_s = mu_s_min (because then d = D and
+	// thus a = A), equal to 1 for mu_s = 1 (because then d = d_min and thus
+	// a = 0), and with a large slope around mu_s = 0, to get more texture
+	// samples near the horizon.
+	float u_mu_s = GetTextureCoordFromUnitRange(std::max(1.f - a / A, 0.f) / (1.f + a), derived.invScatteringSize[1]);
+
+	float u_nu = (nu + 1.f) / 2.f;
+	uvwz[0] = u_nu;
+	uvwz[1] = u_mu_s;
+	uvwz[2] = u_mu;
+	uvwz[3] = u_r;
+}
+
+template<int N> void CpuAtmosphereEngine<N>::GetRMuMuSNuFromScatteringTextureUvwz(const float uvwz[4], float& r, float& mu, float& mu_s, float& nu, bool& ray_r_mu_intersects_ground) const
+{
+	// Distance to top atmosphere boundary for a horizontal ray at ground level.
+	float H = derived.horizonDistance;
+	// Distance to the horizon.
+	float rho = H * GetUnitRangeFromTextureCoord(uvwz[3], derived.invScatteringSize[3]);
+	r = std::sqrt(rho * rho + derived.bottomRadiusSq);
+
+	if (uvwz[2] < 0.5f)
+	{
+		// Distance to the ground for the ray (r,mu), and its minimum and maximum
+		// values over all mu - obtained for (r,-1) and (r,mu_horizon) - from which
+		// we can recover mu:
+		float d_min = r - params.bottomRadius;
+		float d_max = rho;
+		float d = d_min + (d_max - d_min) * GetUnitRangeFromTextureCoord(1.f - 2.f * uvwz[2], derived.invScatteringSize[2]);
+		mu = d == 0.f ? -1.f : ClampCosine(-(rho * rho + d * d) / (2.f * r * d));
+		ray_r_mu_intersects_ground = true;
+	}
+	else
+	{
+		// Distance to the top atmosphere boundary for the ray (r,mu), and its
+		// minimum and maximum values over all mu - obtained for (r,1) and
+		// (r,mu_horizon) - from which we can recover mu:
+		float d_min = params.topRadius - r;
+		float d_max = rho + H;
+		float d = d_min + (d_max - d_min) * GetUnitRangeFromTextureCoord(2.f * uvwz[2] - 1.f, derived.invScatteringSize[2]);
+		mu = d == 0.f ? 1.f : ClampCosine((H * H - rho * rho - d * d) / (2.f * r * d));
+		ray_r_mu_intersects_ground = false;
+	}
+
+	float x_mu_s = GetUnitRangeFromTextureCoord(uvwz[1], derived.invScatteringSize[1]);
+	float d_min = derived.thickness;
+	float d_max = H;
+	float A = derived.muSMinParameter;
+	float a = (A - x_mu_s * A) / (1.f + x_mu_s * A);
+	float d = d_min + std::min(a, A) * (d_max - d_min);
+	mu_s = d == 0.f ? 1.f : ClampCosine((H * H - d * d) / (2.f * params.bottomRadius * d));
+
+	nu = ClampCosine(uvwz[0] * 2.f - 1.f);
+}
+
+template<int N> void CpuAtmosphereEngine<N>::GetRMuMuSNuFromScatteringTexel(int x, int y, int z, float& r, float& mu, float& mu_s, float& nu, bool& ray_r_mu_intersects_ground) const
+{
+	float frag_coord_nu = std::floor(float(x) / float(dims.scatteringMuS));
+	float frag_coord_mu_s = std::fmod(float(x), float(dims.scatteringMuS));
+	float uvwz[4] = { frag_coord_nu / float(dims.scatteringNu - 1)
+		, (frag_coord_mu_s + 0.5f) / float(dims.scatteringMuS)
+		, (float(y) + 0.5f) / float(dims.scatteringMu)
+		, (float(z) + 0.5f) / float(dims.scatteringR) };
+	GetRMuMuSNuFromScatteringTextureUvwz(uvwz, r, mu, mu_s, nu, ray_r_mu_intersects_ground);
+	// Clamp nu to its valid range of values, given mu and mu_s.
+	nu = std::min(std::max(nu, mu * mu_s - SafeSqrt((1.f - mu * mu) * (1.f - mu_s * mu_s))), mu * mu_s + SafeSqrt((1.f - mu * mu) * (1.f - mu_s * mu_s)));
+}
+
+template<int N> Spectrum<N> CpuAtmosphereEngine<N>::GetTransmittanceToTopAtmosphereBoundary(const CpuLutSet& luts, float r, float mu) const
+{
+	float u, v;
+	GetTransmittanceTextureUvFromRMu(r, mu, u, v);
+	return Sample2D<N>(luts.transmittance, u, v);
+}
+
+template<int N> Spectrum<N> CpuAtmosphereEngine<N>::GetTransmittance(const CpuLutSet& luts, float r, float mu, float d, bool ray_r_mu_intersects_ground) const
+{
+	float r_d = std::min(std::max(std::sqrt(d * d + 2.f * r * mu * d + r * r), params.bottomRadius), params.topRadius);
+	float mu_d = ClampCosine((r * mu + d) / r_d);
+
+	if (ray_r_mu_intersects_ground)
+		return GetTransmittanceToTopAtmosphereBoundary(luts, r_d, -mu_d).SafeDivide(GetTransmittanceToTopAtmosphereBoundary(luts, r, -mu)).Min(1.f);
+	return GetTransmittanceToTopAtmosphereBoundary(luts, r, mu).SafeDivide(GetTransmittanceToTopAtmosphereBoundary(luts, r_d, mu_d)).Min(1.f);
+}
+
+template<int N> Spectrum<N> CpuAtmosphereEngine<N>::GetTransmittanceToSun(const CpuLutSet& luts, float r, float mu_s) const
+{
+	float sin_theta_h = params.bottomRadius / r;
+	float cos_theta_h = -SafeSqrt(1.f - sin_theta_h * sin_theta_h);
+	float edge0 = -sin_theta_h * params.sunAngularRadius;
+	float edge1 = sin_theta_h * params.sunAngularRadius;
+	float t = std::min(std::max((mu_s - cos_theta_h - edge0) / (edge1 - edge0), 0.f), 1.f);
+	return GetTransmittanceToTopAtmosphereBoundary(luts, r, mu_s) * (t * t * (3.f - 2.f * t));
+}
+
+template<int N> Spectrum<N> CpuAtmosphereEngine<N>::GetScattering(const CpuLut& lut, float r, float mu, float mu_s, float nu, bool ray_r_mu_intersects_ground) const
+{
+	float uvwz[4];
+	GetScatteringTextureUvwzFromRMuMuSNu(r, mu, mu_s, nu, ray_r_mu_intersects_ground, uvwz);
+	float tex_coord_x = uvwz[0] * float(dims.scatteringNu - 1);
+	float tex_x = std::floor(tex_coord_x);
+	float lerp = tex_coord_x - tex_x;
+	float u0 = (tex_x + uvwz[1]) * derived.invScatteringSize[0];
+	float u1 = (tex_x + 1.f + uvwz[1]) * derived.invScatteringSize[0];
+	return Sample3D<N>(lut, u0, uvwz[2], uvwz[3]) * (1.f - lerp) + Sample3D<N>(lut, u1, uvwz[2], uvwz[3]) * lerp;
+}
+
+template<int N> Spectrum<N> CpuAtmosphereEngine<N>::GetMultipleScatteringTransfer(const CpuLutSet& luts, float r, float mu_s) const
+{
+	float u = GetTextureCoordFromUnitRange(mu_s * 0.5f + 0.5f, derived.invTransferSize[0]);
+	float v = GetTextureCoordFromUnitRange((r - params.bottomRadius) / derived.thickness, derived.invTransferSize[1]);
+	return Sample2D<N>(luts.multipleScatteringTransfer, u, v);
+}
+
+template<int N> Spectrum<N> CpuAtmosphereEngine<N>::ComputeTransmittanceToTopAtmosphereBoundary(float r, float mu) const
+{
+	// Number of intervals for the numerical integration.
+	const int SAMPLE_COUNT = 500;
+	// The integration step, i.e. the length of each integration interval.
+	float dx = DistanceToTopAtmosphereBoundary(r, mu) / float(SAMPLE_COUNT);
+
+	float rayleighResult = 0.f;
+	float mieResult = 0.f;
+	float absorptionResult = 0.f;
+	for (int i = 0; i <= SAMPLE_COUNT; ++i)
+	{
+		float d_i = float(i) * dx;
+		// Distance between the current sample point and the planet center.
+		float r_i = std::sqrt(d_i * d_i + 2.f * r * mu * d_i + r * r);
+		// Sample weight (from the trapezoidal rule).
+		float weight_i = (i == 0 || i == SAMPLE_COUNT) ? 0.5f : 1.f;
+		float altitude = r_i - params.bottomRadius;
+		rayleighResult += params.rayleighDensity.Density(altitude) * weight_i * dx;
+		mieResult += params.mieDensity.Density(altitude) * weight_i * dx;
+		absorptionResult += params.absorptionDensity.Density(altitude) * weight_i * dx;
+	}
+	return (rayleighScattering * -rayleighResult + mieExtinction * -mieResult + absorptionExtinction * -absorptionResult).Exp();
+}
+
+template<int N> void CpuAtmosphereEngine<N>::BakeTransmittance(CpuLutSet& luts, int begin, int end) const
+{
+	CpuLut& lut = luts.transmittance;
+	for (int y = begin; y < end; y++)
+	{
+		for (int x = 0; x < lut.desc.width; x++)
+		{
+			float r, mu;
+			GetRMuFromTransmittanceTextureUv((float(x) + 0.5f) / float(lut.desc.width), (float(y) + 0.5f) / float(lut.desc.height), r, mu);
+			StoreTexel(lut, x, y, 0, ComputeTransmittanceToTopAtmosphereBoundary(r, mu));
+		}
+	}
+}
+
+template<int N> void CpuAtmosphereEngine<N>::BakeDirectIrradiance(CpuLutSet& luts, int begin, int end) const
+{
+	CpuLut& lut = luts.directIrradiance;
+	for (int y = begin; y < end; y++)
+	{
+		for (int x = 0; x < lut.desc.width; x++)
+		{
+			float x_mu_s = GetUnitRangeFromTextureCoord((float(x) + 0.5f) * derived.invIrradianceSize[0], derived.invIrradianceSize[0]);
+			float x_r = GetUnitRangeFromTextureCoord((float(y) + 0.5f) * derived.invIrradianceSize[1], derived.invIrradianceSize[1]);
+			float r = params.bottomRadius + x_r * derived.thickness;
+			float mu_s = ClampCosine(2.f * x_mu_s - 1.f);
+			float alpha_s = params.sunAngularRadius;
+			// Approximate average of the cosine factor mu_s over the visible fraction of
+			// the Sun disc.
+			float average_cosine_factor = mu_s < -alpha_s ? 0.f : (mu_s > alpha_s ? mu_s : (mu_s + alpha_s) * (mu_s + alpha_s) / (4.f * alpha_s));
+			StoreTexel(lut, x, y, 0, GetTransmittanceToTopAtmosphereBoundary(luts, r, mu_s) * (params.solarIrradiance * average_cosine_factor));
+		}
+	}
+}
+
+template<int N> void CpuAtmosphereEngine<N>::BakeMultipleScatteringTransfer(CpuLutSet& luts, int begin, int end) const
+{
+	// Directions over the sphere, equal-area in cos(theta) and phi, and steps along each.
+	const int SQRT_DIRECTION_COUNT = 16;
+	const int DIRECTION_COUNT = SQRT_DIRECTION_COUNT * SQRT_DIRECTION_COUNT;
+	const int SAMPLE_COUNT = 20;
+	const float ISOTROPIC_PHASE = 1.f / (4.f * PI);
+	CpuLut& lut = luts.multipleScatteringTransfer;
+	for (int y = begin; y < end; y++)
+	{
+		for (int x = 0; x < lut.desc.width; x++)
+		{
+			float x_mu_s = GetUnitRangeFromTextureCoord((float(x) + 0.5f) * derived.invTransferSize[0], derived.invTransferSize[0]);
+			float x_r = GetUnitRangeFromTextureCoord((float(y) + 0.5f) * derived.invTransferSize[1], derived.invTransferSize[1]);
+			float r = params.bottomRadius + x_r * derived.thickness;
+			float mu_s = ClampCosine(2.f * x_mu_s - 1.f);
+			float omega_s[3] = { SafeSqrt(1.f - mu_s * mu_s), 0.f, mu_s };
+
+			// Over all directions, the average of the second order radiance L_2 that single scattering
+			// and the ground send back to this point, and of the fraction f_ms of isotropic unit
+			// radiance scattered back, both under an isotropic phase function.
+			SpectrumN second_order = SpectrumN::Zero();
+			SpectrumN transfer = SpectrumN::Zero();
+			for (int l = 0; l < SQRT_DIRECTION_COUNT; ++l)
+			{
+				float cos_theta = 1.f - 2.f * (float(l) + 0.5f) / float(SQRT_DIRECTION_COUNT);
+				float sin_theta = SafeSqrt(1.f - cos_theta * cos_theta);
+				bool ray_r_theta_intersects_ground = RayIntersectsGround(r, cos_theta);
+				float distance = ray_r_theta_intersects_ground ? DistanceToBottomAtmosphereBoundary(r, cos_theta) : DistanceToTopAtmosphereBoundary(r, cos_theta);
+				float dx = distance / float(SAMPLE_COUNT);
+				for (int m = 0; m < SQRT_DIRECTION_COUNT; ++m)
+				{
+					float phi = 2.f * PI * (float(m) + 0.5f) / float(SQRT_DIRECTION_COUNT);
+					float omega[3] = { std::cos(phi) * sin_theta, std::sin(phi) * sin_theta, cos_theta };
+					float nu = omega[0] * omega_s[0] + omega[1] * omega_s[1] + omega[2] * omega_s[2];
+					for (int i = 0; i < SAMPLE_COUNT; ++i)
+					{
+						float d_i = (float(i) + 0.5f) * dx;
+						float r_i = std::min(std::max(std::sqrt(d_i * d_i + 2.f * r * cos_theta * d_i + r * r), params.bottomRadius), params.topRadius);
+						float mu_s_i = ClampCosine((r * mu_s + d_i * nu) / r_i);
+						float altitude = r_i - params.bottomRadius;
+						SpectrumN scattering = rayleighScattering * params.rayleighDensity.Density(altitude) + mieScattering * params.mieDensity.Density(altitude);
+						SpectrumN scattered = GetTransmittance(luts, r, cos_theta, d_i, ray_r_theta_intersects_ground) * scattering * dx;
+						second_order += scattered * GetTransmittanceToSun(luts, r_i, mu_s_i) * (params.solarIrradiance * ISOTROPIC_PHASE);
+						transfer += scattered;
+					}
+					if (ray_r_theta_intersects_ground)
+					{
+						// Sunlight reflected by the Lambertian ground.
+						float ground_normal[3] = { omega[0] * distance, omega[1] * distance, r + omega[2] * distance };
+						float ground_mu_s = ClampCosine((ground_normal[0] * omega_s[0] + ground_normal[1] * omega_s[1] + ground_normal[2] * omega_s[2]) / params.bottomRadius);
+						second_order += GetTransmittance(luts, r, cos_theta, distance, true) * GetTransmittanceToSun(luts, params.bottomRadius, ground_mu_s)
+							* (params.solarIrradiance * std::max(ground_mu_s, 0.f) * params.groundAlbedo / PI);
+					}
+				}
+			}
+			second_order *= 1.f / float(DIRECTION_COUNT);
+			transfer *= 1.f / float(DIRECTION_COUNT);
+			// Each further order returns the fraction f_ms of the one before, so all of them together
+			// are L_2 * (1 + f_ms + f_ms^2 + ...) = L_2 / (1 - f_ms).
+			StoreTexel(lut, x, y, 0, second_order.SafeDivide(SpectrumN::Constant(1.f) - transfer));
+		}
+	}
+}
+
+template<int N> void CpuAtmosphereEngine<N>::BakeSingleScattering(CpuLutSet& luts, int begin, int end) const
+{
+	const int SAMPLE_COUNT = 50;
+	const bool transfer = params.multipleScatteringMethod == MultipleScatteringMethod::TRANSFER_LUT;
+	for (int z = begin; z < end; z++)
+	{
+		for (int y = 0; y < dims.scatteringMu; y++)
+		{
+			for (int x = 0; x < dims.ScatteringWidth(); x++)
+			{
+				float r, mu, mu_s, nu;
+				bool ray_r_mu_intersects_ground;
+				GetRMuMuSNuFromScatteringTexel(x, y, z, r, mu, mu_s, nu, ray_r_mu_intersects_ground);
+				float dx = (ray_r_mu_intersects_ground ? DistanceToBottomAtmosphereBoundary(r, mu) : DistanceToTopAtmosphereBoundary(r, mu)) / float(SAMPLE_COUNT);
+
+				SpectrumN rayleigh_sum = SpectrumN::Zero();
+				SpectrumN mie_sum = SpectrumN::Zero();
+				SpectrumN multiple_sum = SpectrumN::Zero();
+				for (int i = 0; i <= SAMPLE_COUNT; ++i)
+				{
+					float d_i = float(i) * dx;
+					float r_d = std::min(std::max(std::sqrt(d_i * d_i + 2.f * r * mu * d_i + r * r), params.bottomRadius), params.topRadius);
+					float mu_s_d = ClampCosine((r * mu_s + d_i * nu) / r_d);
+					SpectrumN view_transmittance = GetTransmittance(luts, r, mu, d_i, ray_r_mu_intersects_ground);
+					SpectrumN transmittance = view_transmittance * GetTransmittanceToSun(luts, r_d, mu_s_d);
+					float weight_i = (i == 0 || i == SAMPLE_COUNT) ? 0.5f : 1.f;
+					float altitude = r_d - params.bottomRadius;
+					float rayleigh_density = params.rayleighDensity.Density(altitude);
+					float mie_density = params.mieDensity.Density(altitude);
+					rayleigh_sum += transmittance * (rayleigh_density * weight_i);
+					mie_sum += transmittance * (mie_density * weight_i);
+					if (transfer)
+					{
+						// The isotropic multiply-scattered light at this point, scattered towards the viewer.
+						SpectrumN scattering = rayleighScattering * rayleigh_density + mieScattering * mie_density;
+						multiple_sum += view_transmittance * scattering * GetMultipleScatteringTransfer(luts, r_d, mu_s_d) * weight_i;
+					}
+				}
+				StoreTexel(luts.singleRayleighScattering, x, y, z, rayleigh_sum * rayleighScattering * (dx * params.solarIrradiance));
+				StoreTexel(luts.singleMieScattering, x, y, z, mie_sum * mieScattering * (dx * params.solarIrradiance));
+				// Otherwise the multiple scattering orders accumulate into this.
+				StoreTexel(luts.multipleScattering, x, y, z, multiple_sum * dx);
+			}
+		}
+	}
+}
+
+template<int N> void CpuAtmosphereEngine<N>::BakeScatteringDensity(CpuLutSet& luts, int order, int begin, int end) const
+{
+	const int SAMPLE_COUNT = 16;
+	const float dphi = PI / float(SAMPLE_COUNT);
+	const float dtheta = PI / float(SAMPLE_COUNT);
+	for (int z = begin; z < end; z++)
+	{
+		for (int y = 0; y < dims.scatteringMu; y++)
+		{
+			for (int x = 0; x < dims.ScatteringWidth(); x++)
+			{
+				float r, mu, mu_s, nu;
+				bool ray_r_mu_intersects_ground;
+				GetRMuMuSNuFromScatteringTexel(x, y, z, r, mu, mu_s, nu, ray_r_mu_intersects_ground);
+
+				// Unit direction vectors for the zenith, the view direction omega and the sun direction
+				// omega_s, such that the cosine of the view-zenith angle is mu, the cosine of the
+				// sun-zenith angle is mu_s, and the cosine of the view-sun angle is nu.
+				float omega[3] = { SafeSqrt(1.f - mu * mu), 0.f, mu };
+				float sun_dir_x = omega[0] == 0.f ? 0.f : (nu - mu * mu_s) / omega[0];
+				float sun_dir_y = SafeSqrt(1.f - sun_dir_x * sun_dir_x - mu_s * mu_s);
+				float omega_s[3] = { sun_dir_x, sun_dir_y, mu_s };
+
+				float altitude = r - params.bottomRadius;
+				SpectrumN rayleigh = rayleighScattering * params.rayleighDensity.Density(altitude);
+				SpectrumN mie = mieScattering * params.mieDensity.Density(altitude);
+				SpectrumN rayleigh_mie = SpectrumN::Zero();
+
+				// Nested loops for the integral over all the incident directions omega_i.
+				for (int l = 0; l < SAMPLE_COUNT; ++l)
+				{
+					float theta = (float(l) + 0.5f) * dtheta;
+					float cos_theta = std::cos(theta);
+					float sin_theta = std::sin(theta);
+					bool ray_r_theta_intersects_ground = RayIntersectsGround(r, cos_theta);
+
+					// The distance and transmittance to the ground only depend on theta, so we
+					// can compute them in the outer loop for efficiency. Only the order 2 density
+					// has a ground term: higher orders would need the indirect irradiance, which
+					// is not baked.
+					float distance_to_ground = 0.f;
+					SpectrumN transmittance_to_ground = SpectrumN::Zero();
+					if (ray_r_theta_intersects_ground && order == 2)
+					{
+						distance_to_ground = DistanceToBottomAtmosphereBoundary(r, cos_theta);
+						transmittance_to_ground = GetTransmittance(luts, r, cos_theta, distance_to_ground, true);
+					}
+
+					for (int m = 0; m < 2 * SAMPLE_COUNT; ++m)
+					{
+						float phi = (float(m) + 0.5f) * dphi;
+						float omega_i[3] = { std::cos(phi) * sin_theta, std::sin(phi) * sin_theta, cos_theta };
+						float domega_i = dtheta * dphi * sin_theta;
+
+						// The radiance L_i arriving from direction omega_i after n-1 bounces.
+						float nu1 = omega_s[0] * omega_i[0] + omega_s[1] * omega_i[1] + omega_s[2] * omega_i[2];
+						SpectrumN incident_radiance;
+						if (order == 2)
+						{
+							incident_radiance = GetScattering(luts.singleRayleighScattering, r, omega_i[2], mu_s, nu1, ray_r_theta_intersects_ground) * RayleighPhaseFunction(nu1)
+								+ GetScattering(luts.singleMieScattering, r, omega_i[2], mu_s, nu1, ray_r_theta_intersects_ground) * MiePhaseFunction(params.miePhaseFunction, nu1);
+						}
+						else
+						{
+							incident_radiance = GetScattering(luts.deltaMultipleScattering, r, omega_i[2], mu_s, nu1, ray_r_theta_intersects_ground);
+						}
+
+						// The contribution from the light paths whose last bounce is on the ground.
+						if (distance_to_ground > 0.f)
+						{
+							float ground_normal[3] = { omega_i[0] * distance_to_ground, omega_i[1] * distance_to_ground, r + omega_i[2] * distance_to_ground };
+							float inv_length = 1.f / std::sqrt(ground_normal[0] * ground_normal[0] + ground_normal[1] * ground_normal[1] + ground_normal[2] * ground_normal[2]);
+							float ground_mu_s = (ground_normal[0] * omega_s[0] + ground_normal[1] * omega_s[1] + ground_normal[2] * omega_s[2]) * inv_length;
+							float u = GetTextureCoordFromUnitRange(ground_mu_s * 0.5f + 0.5f, derived.invIrradianceSize[0]);
+							float v = GetTextureCoordFromUnitRange(0.f, derived.invIrradianceSize[1]);
+							SpectrumN ground_irradiance = Sample2D<N>(luts.directIrradiance, u, v);
+							incident_radiance += transmittance_to_ground * ground_irradiance * (params.groundAlbedo / PI);
+						}
+
+						// The radiance finally scattered from direction omega_i towards direction -omega.
+						float nu2 = omega[0] * omega_i[0] + omega[1] * omega_i[1] + omega[2] * omega_i[2];
+						rayleigh_mie += incident_radiance * (rayleigh * RayleighPhaseFunction(nu2) + mie * MiePhaseFunction(params.miePhaseFunction, nu2)) * domega_i;
+					}
+				}
+				StoreTexel(luts.scatteringDensity, x, y, z, rayleigh_mie);
+			}
+		}
+	}
+}
+
+template<int N> void CpuAtmosphereEngine<N>::BakeMultipleScattering(CpuLutSet& luts, int begin, int end) const
+{
+	// Number of intervals for the numerical integration.
+	const int SAMPLE_COUNT = 50;
+	for (int z = begin; z < end; z++)
+	{
+		for (int y = 0; y < dims.scatteringMu; y++)
+		{
+			for (int x = 0; x < dims.ScatteringWidth(); x++)
+			{
+				float r, mu, mu_s, nu;
+				bool ray_r_mu_intersects_ground;
+				GetRMuMuSNuFromScatteringTexel(x, y, z, r, mu, mu_s, nu, ray_r_mu_intersects_ground);
+				// The integration step, i.e. the length of each integration interval.
+				float dx = (ray_r_mu_intersects_ground ? DistanceToBottomAtmosphereBoundary(r, mu) : DistanceToTopAtmosphereBoundary(r, mu)) / float(SAMPLE_COUNT);
+				SpectrumN rayleigh_mie_sum = SpectrumN::Zero();
+				for (int i = 0; i <= SAMPLE_COUNT; ++i)
+				{
+					float d_i = float(i) * dx;
+					// The r, mu and mu_s parameters at the current integration point.
+					float r_i = std::min(std::max(std::sqrt(d_i * d_i + 2.f * r * mu * d_i + r * r), params.bottomRadius), params.topRadius);
+					float mu_i = ClampCosine((r * mu + d_i) / r_i);
+					float mu_s_i = ClampCosine((r * mu_s + d_i * nu) / r_i);
+					// The scattering density at the current sample point, attenuated back to the start of the ray.
+					SpectrumN rayleigh_mie_i = GetScattering(luts.scatteringDensity, r_i, mu_i, mu_s_i, nu, ray_r_mu_intersects_ground) * GetTransmittance(luts, r, mu, d_i, ray_r_mu_intersects_ground) * dx;
+					// Sample weight (from the trapezoidal rule).
+					float weight_i = (i == 0 || i == SAMPLE_COUNT) ? 0.5f : 1.f;
+					rayleigh_mie_sum += rayleigh_mie_i * weight_i;
+				}
+				StoreTexel(luts.deltaMultipleScattering, x, y, z, rayleigh_mie_sum);
+				StoreTexel(luts.multipleScattering, x, y, z, LoadTexel<N>(luts.multipleScattering, x, y, z) + rayleigh_mie_sum);
+			}
+		}
+	}
+}
+
+template<int N> void CpuAtmosphereEngine<N>::Bake(CpuLutSet& luts) const
+{
+	BakeTransmittance(luts, 0, dims.transmittanceHeight);
+	BakeDirectIrradiance(luts, 0, dims.irradianceHeight);
+	if (params.multipleScatteringMethod == MultipleScatteringMethod::TRANSFER_LUT)
+	{
+		BakeMultipleScatteringTransfer(luts, 0, dims.transferHeight);
+		BakeSingleScattering(luts, 0, dims.scatteringR);
+		return;
+	}
+	BakeSingleScattering(luts, 0, dims.scatteringR);
+	for (int order = 2; order <= params.scatteringOrders; order++)
+	{
+		BakeScatteringDensity(luts, order, 0, dims.scatteringR);
+		BakeMultipleScattering(luts, 0, dims.scatteringR);
+	}
+}
+
+template<int N> void CpuAtmosphereEngine<N>::WriteRgba(const CpuLut& src, CpuLut& dst, int begin, int end) const
+{
+	// Rows of a 2D table, slices of a 3D one.
+	size_t texelsPerUnit = size_t(src.desc.width) * (src.desc.depth > 1 ? size_t(src.desc.height) : 1);
+	const float* s = src.texels + texelsPerUnit * begin * N;
+	float* d = dst.texels + texelsPerUnit * begin * 4;
+	for (size_t t = 0; t < texelsPerUnit * size_t(end - begin); t++, s += N, d += 4)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			float v = 0.f;
+			for (int i = 0; i < N; i++)
+				v += rgbWeights[c][i] * s[i];
+			// Saturated spectra can fall outside the sRGB gamut; clip rather than store negative radiance.
+			d[c] = std::max(v, 0.f);
+		}
+		d[3] = 0.f;
+	}
+}
+
+template class CpuAtmosphereEngine<int(SpectralMode::RGB)>;
+template class CpuAtmosphereEngine<int(SpectralMode::SPECTRAL_8)>;
+template class CpuAtmosphereEngine<int(SpectralMode::SPECTRAL_16)>;
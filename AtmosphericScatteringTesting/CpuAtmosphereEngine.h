@@ -0,0 +1,133 @@
+#pragma once
+
+#include "AtmosphereParameters.h"
+#include "LutBufferPool.h"
+#include "Spectrum.h"
+
+//! A CPU look-up table of tightly-packed float texels, x fastest, then y, then z.
+struct CpuLut
+{
+	LutDesc desc;
+	float* texels = nullptr;
+
+	int Channels() const
+	{
+		return desc.bytesPerTexel / int(sizeof(float));
+	}
+	size_t TexelIndex(int x, int y, int z) const
+	{
+		return (size_t(z) * desc.height + y) * desc.width + x;
+	}
+	float* Texel(int x, int y, int z = 0)
+	{
+		return texels + TexelIndex(x, y, z) * Channels();
+	}
+	const float* Texel(int x, int y, int z = 0) const
+	{
+		return texels + TexelIndex(x, y, z) * Channels();
+	}
+};
+
+//! All the tables produced by one bake. Storage comes from a LutBufferPool.
+struct CpuLutSet
+{
+	LutDimensions dims;
+	CpuLut transmittance;
+	CpuLut directIrradiance;
+	CpuLut singleRayleighScattering;
+	CpuLut singleMieScattering;
+	CpuLut scatteringDensity;
+	CpuLut deltaMultipleScattering;	// Multiple scattering of the order currently being computed.
+	CpuLut multipleScattering;		// Sum of all orders from 2 upwards.
+	CpuLut multipleScatteringTransfer;	// Only used by MultipleScatteringMethod::TRANSFER_LUT.
+
+	//! With intermediates false, only the tables uploaded to the GPU are acquired: enough
+	//! to hold the output of a bake but not to run one.
+	void Acquire(LutBufferPool& pool, const LutDimensions& d, int channels, bool intermediates = true);
+	void Release(LutBufferPool& pool);
+};
+
+//! Number of values the CPU engine carries per sample: RGB, or 8 or 16 wavelengths so that one
+//! AVX2 or AVX-512 register holds a whole spectrum.
+enum class SpectralMode
+{
+	RGB = 4,
+	SPECTRAL_8 = 8,
+	SPECTRAL_16 = 16
+};
+
+//! CPU implementation of the precompute passes in atmospheric_transmittance.sfx and
+//! atmospheric_scattering.sfx, carrying N values per sample (see SpectralMode). The engine is
+//! immutable once built, so any number of threads may run its stages at once, as long as they
+//! write to separate rows or slices. Its tables have N channels per texel; WriteRgba() turns
+//! them into RGBA for upload.
+template<int N> class CpuAtmosphereEngine
+{
+public:
+	typedef Spectrum<N> SpectrumN;
+
+	//! Throws std::invalid_argument if p or d is out of range; see MakeDerivedConstants().
+	CpuAtmosphereEngine(const AtmosphereParameters& p, const LutDimensions& d);
+
+	const AtmosphereParameters& GetParameters() const
+	{
+		return params;
+	}
+	const LutDimensions& GetDimensions() const
+	{
+		return dims;
+	}
+	const DerivedAtmosphereConstants& GetDerivedConstants() const
+	{
+		return derived;
+	}
+
+	// Each stage fills rows [begin,end) of a 2D table or r-slices [begin,end) of a 3D table.
+	void BakeTransmittance(CpuLutSet& luts, int begin, int end) const;
+	void BakeDirectIrradiance(CpuLutSet& luts, int begin, int end) const;
+	//! Rows [begin,end) of the multiple scattering transfer table; needs only the transmittance.
+	void BakeMultipleScatteringTransfer(CpuLutSet& luts, int begin, int end) const;
+	//! Also initialises multipleScattering: to zero for the iterative orders to add into, or, with
+	//! MultipleScatteringMethod::TRANSFER_LUT, to all the orders at once from the transfer table.
+	void BakeSingleScattering(CpuLutSet& luts, int begin, int end) const;
+	//! Scattering density for the given order (>=2), from the scattering of order-1.
+	void BakeScatteringDensity(CpuLutSet& luts, int order, int begin, int end) const;
+	//! Integrates the density into deltaMultipleScattering and adds it to multipleScattering.
+	void BakeMultipleScattering(CpuLutSet& luts, int begin, int end) const;
+	//! Runs every stage on the calling thread.
+	void Bake(CpuLutSet& luts) const;
+	//! Converts rows or r-slices [begin,end) of src to the RGBA table dst: a copy for the RGB engine,
+	//! an integration against the CIE matching functions for the spectral ones.
+	void WriteRgba(const CpuLut& src, CpuLut& dst, int begin, int end) const;
+
+	// Parameterisation of the tables, ported from atmospheric_testing.sl.
+	float DistanceToTopAtmosphereBoundary(float r, float mu) const;
+	float DistanceToBottomAtmosphereBoundary(float r, float mu) const;
+	bool RayIntersectsGround(float r, float mu) const;
+	void GetTransmittanceTextureUvFromRMu(float r, float mu, float& u, float& v) const;
+	void GetRMuFromTransmittanceTextureUv(float u, float v, float& r, float& mu) const;
+	void GetScatteringTextureUvwzFromRMuMuSNu(float r, float mu, float mu_s, float nu, bool ray_r_mu_intersects_ground, float uvwz[4]) const;
+	void GetRMuMuSNuFromScatteringTextureUvwz(const float uvwz[4], float& r, float& mu, float& mu_s, float& nu, bool& ray_r_mu_intersects_ground) const;
+
+	SpectrumN GetTransmittanceToTopAtmosphereBoundary(const CpuLutSet& luts, float r, float mu) const;
+	SpectrumN GetTransmittance(const CpuLutSet& luts, float r, float mu, float d, bool ray_r_mu_intersects_ground) const;
+	SpectrumN GetTransmittanceToSun(const CpuLutSet& luts, float r, float mu_s) const;
+	SpectrumN GetScattering(const CpuLut& lut, float r, float mu, float mu_s, float nu, bool ray_r_mu_intersects_ground) const;
+	//! The radiance of all orders of scattering above one arriving at (r,mu_s), treated as isotropic.
+	SpectrumN GetMultipleScatteringTransfer(const CpuLutSet& luts, float r, float mu_s) const;
+
+private:
+	void GetRMuMuSNuFromScatteringTexel(int x, int y, int z, float& r, float& mu, float& mu_s, float& nu, bool& ray_r_mu_intersects_ground) const;
+	SpectrumN ComputeTransmittanceToTopAtmosphereBoundary(float r, float mu) const;
+
+	AtmosphereParameters params;
+	LutDimensions dims;
+	DerivedAtmosphereConstants derived;
+	SpectrumN rayleighScattering;
+	SpectrumN mieScattering;
+	SpectrumN mieExtinction;
+	SpectrumN absorptionExtinction;
+	float rgbWeights[3][N];
+};
+
+typedef CpuAtmosphereEngine<int(SpectralMode::RGB)> RgbAtmosphereEngine;
@@ -0,0 +1,186 @@
+#include "LutBufferPool.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static size_t RoundUp(size_t bytes, size_t granularity)
+{
+	return ((bytes + granularity - 1) / granularity) * granularity;
+}
+
+#ifdef _WIN32
+// MEM_LARGE_PAGES needs SeLockMemoryPrivilege. The account must have been granted "Lock pages in
+// memory"; even then the privilege is disabled in the process token until it is adjusted here.
+static bool EnableLockMemoryPrivilege()
+{
+	HANDLE token = nullptr;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		return false;
+	TOKEN_PRIVILEGES privileges = {};
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool enabled = LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+		&& AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+		// AdjustTokenPrivileges succeeds without enabling anything if the account lacks the privilege.
+		&& GetLastError() == ERROR_SUCCESS;
+	CloseHandle(token);
+	return enabled;
+}
+#endif
+
+LutBufferPool::LutBufferPool(bool huge)
+	: useHugePages(huge)
+{
+#ifdef _WIN32
+	if (useHugePages)
+		useHugePages = GetLargePageMinimum() != 0 && EnableLockMemoryPrivilege();
+#endif
+}
+
+LutBufferPool::~LutBufferPool()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& i : freeBlocks)
+		Free(i.second);
+	for (auto& i : usedBlocks)
+		Free(i.second);
+	freeBlocks.clear();
+	usedBlocks.clear();
+}
+
+LutBufferPool::Block LutBufferPool::Allocate(const LutDesc& desc)
+{
+	Block block;
+	block.desc = desc;
+	block.bytes = RoundUp(desc.ByteSize(), Alignment);
+	if (useHugePages)
+	{
+#ifdef _WIN32
+		// Large pages must be physically contiguous, so this can still fail once memory is fragmented.
+		size_t largePage = GetLargePageMinimum();
+		if (largePage)
+		{
+			size_t bytes = RoundUp(block.bytes, largePage);
+			void* p = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (p)
+			{
+				block.data = p;
+				block.bytes = bytes;
+				block.hugePages = true;
+			}
+		}
+#else
+		// Only keep the mapping if the kernel accepts the hint; otherwise it is just normal pages.
+#ifdef MADV_HUGEPAGE
+		const size_t hugePage = 2 * 1024 * 1024;
+		size_t bytes = RoundUp(block.bytes, hugePage);
+		void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			if (madvise(p, bytes, MADV_HUGEPAGE) == 0)
+			{
+				block.data = p;
+				block.bytes = bytes;
+				block.hugePages = true;
+			}
+			else
+			{
+				munmap(p, bytes);
+			}
+		}
+#endif
+#endif
+	}
+	if (!block.data)
+	{
+#ifdef _WIN32
+		block.data = _aligned_malloc(block.bytes, Alignment);
+#else
+		block.data = std::aligned_alloc(Alignment, block.bytes);
+#endif
+		if (!block.data)
+			throw std::bad_alloc();
+	}
+	stats.allocationCount++;
+	stats.currentBytes += block.bytes;
+	if (stats.currentBytes > stats.highWaterBytes)
+		stats.highWaterBytes = stats.currentBytes;
+	return block;
+}
+
+void LutBufferPool::Free(const Block& block)
+{
+	if (block.hugePages)
+	{
+#ifdef _WIN32
+		VirtualFree(block.data, 0, MEM_RELEASE);
+#else
+		munmap(block.data, block.bytes);
+#endif
+	}
+	else
+	{
+#ifdef _WIN32
+		_aligned_free(block.data);
+#else
+		std::free(block.data);
+#endif
+	}
+	stats.currentBytes -= block.bytes;
+}
+
+void* LutBufferPool::Acquire(const LutDesc& desc)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.acquireCount++;
+	Block block;
+	auto i = freeBlocks.find(desc);
+	if (i != freeBlocks.end())
+	{
+		block = i->second;
+		freeBlocks.erase(i);
+		stats.reuseCount++;
+	}
+	else
+	{
+		block = Allocate(desc);
+	}
+	usedBlocks[block.data] = block;
+	return block.data;
+}
+
+void LutBufferPool::Release(void* buffer)
+{
+	if (!buffer)
+		return;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto i = usedBlocks.find(buffer);
+	if (i == usedBlocks.end())
+		return;
+	freeBlocks.insert({ i->second.desc, i->second });
+	usedBlocks.erase(i);
+}
+
+void LutBufferPool::Trim()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& i : freeBlocks)
+		Free(i.second);
+	freeBlocks.clear();
+}
+
+LutPoolStats LutBufferPool::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
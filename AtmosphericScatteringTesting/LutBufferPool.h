@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+//! Size and texel stride of a look-up table. Used as the key when pooling LUT storage,
+//! so that a re-bake at the same resolution gets back the buffer it released.
+struct LutDesc
+{
+	int width = 0;
+	int height = 0;
+	int depth = 1;
+	int bytesPerTexel = 4 * sizeof(float);
+
+	size_t TexelCount() const
+	{
+		return size_t(width) * size_t(height) * size_t(depth);
+	}
+	size_t ByteSize() const
+	{
+		return TexelCount() * size_t(bytesPerTexel);
+	}
+	bool operator<(const LutDesc& d) const
+	{
+		if (width != d.width)
+			return width < d.width;
+		if (height != d.height)
+			return height < d.height;
+		if (depth != d.depth)
+			return depth < d.depth;
+		return bytesPerTexel < d.bytesPerTexel;
+	}
+	bool operator==(const LutDesc& d) const
+	{
+		return width == d.width && height == d.height && depth == d.depth && bytesPerTexel == d.bytesPerTexel;
+	}
+};
+
+//! Counters shared by the CPU and GPU LUT pools.
+struct LutPoolStats
+{
+	size_t currentBytes = 0;		// Bytes currently allocated, whether in use or idle.
+	size_t highWaterBytes = 0;		// Largest value currentBytes has reached.
+	uint64_t allocationCount = 0;	// Allocations that went to the system/device.
+	uint64_t acquireCount = 0;		// Calls to Acquire(), including those served from the free list.
+	uint64_t reuseCount = 0;		// Calls to Acquire() served from the free list.
+};
+
+//! Hands out 64-byte aligned CPU buffers for LUTs and keeps released buffers for reuse,
+//! so re-bakes and ping-pong passes don't hit the allocator for 16MB volumes each time.
+//! Thread-safe: bake jobs may acquire and release from worker threads.
+class LutBufferPool
+{
+public:
+	static const size_t Alignment = 64;
+
+	//! If useHugePages is set, buffers are backed by large pages where the OS allows it,
+	//! falling back silently to normal pages otherwise. On Windows this enables the process's
+	//! SeLockMemoryPrivilege, which the account must hold for large pages to be used at all.
+	LutBufferPool(bool useHugePages = false);
+	~LutBufferPool();
+	LutBufferPool(const LutBufferPool&) = delete;
+	LutBufferPool& operator=(const LutBufferPool&) = delete;
+
+	//! Returns a buffer of at least desc.ByteSize() bytes. The contents are undefined.
+	void* Acquire(const LutDesc& desc);
+	template<typename T> T* Acquire(const LutDesc& desc)
+	{
+		return static_cast<T*>(Acquire(desc));
+	}
+	//! Returns a buffer obtained from Acquire() to the pool.
+	void Release(void* buffer);
+	//! Frees all idle buffers back to the system.
+	void Trim();
+	LutPoolStats GetStats() const;
+	//! False if huge pages were not asked for, or if the process may not use them.
+	bool UsesHugePages() const
+	{
+		return useHugePages;
+	}
+
+private:
+	struct Block
+	{
+		void* data = nullptr;
+		size_t bytes = 0;
+		bool hugePages = false;
+		LutDesc desc;
+	};
+	Block Allocate(const LutDesc& desc);
+	void Free(const Block& block);
+
+	bool useHugePages = false;
+	std::multimap<LutDesc, Block> freeBlocks;
+	std::map<void*, Block> usedBlocks;
+	LutPoolStats stats;
+	mutable std::mutex mutex;
+};
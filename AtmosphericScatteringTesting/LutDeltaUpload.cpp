@@ -0,0 +1,141 @@
+#include "LutDeltaUpload.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace simul;
+
+LutDeltaStats LutDeltaTracker::Update(const CpuLut& lut, std::vector<LutTexelRange>& dirty)
+{
+	dirty.clear();
+	const size_t valueCount = lut.desc.TexelCount() * size_t(lut.Channels());
+	const bool sameSize = lut.desc == desc && resident.size() == valueCount;
+	if (!sameSize)
+	{
+		desc = lut.desc;
+		resident.resize(valueCount);
+	}
+
+	LutDeltaStats stats;
+	stats.totalBytes = lut.desc.ByteSize();
+	const int rows = std::max(1, std::min(brickRows, lut.desc.height));
+	const size_t rowTexels = size_t(lut.desc.width);
+	const size_t channels = size_t(lut.Channels());
+	for (int z = 0; z < lut.desc.depth; z++)
+	{
+		for (int y = 0; y < lut.desc.height; y += rows)
+		{
+			const size_t first = lut.TexelIndex(0, y, z);
+			const size_t count = size_t(std::min(rows, lut.desc.height - y)) * rowTexels;
+			const float* texels = lut.texels + first * channels;
+			float* residentTexels = resident.data() + first * channels;
+			stats.brickCount++;
+			if (sameSize && !IsBrickChanged(texels, residentTexels, count * channels))
+				continue;
+			stats.dirtyBrickCount++;
+			memcpy(residentTexels, texels, count * channels * sizeof(float));
+			if (!dirty.empty() && dirty.back().first + dirty.back().count == first)
+				dirty.back().count += count;
+			else
+				dirty.push_back({ first, count });
+			stats.uploadedBytes += count * size_t(lut.desc.bytesPerTexel);
+		}
+	}
+	return stats;
+}
+
+bool LutDeltaTracker::IsBrickChanged(const float* texels, const float* residentTexels, size_t valueCount) const
+{
+	// No early out within a row: a branch-free inner loop is cheaper than stopping at the first change.
+	const size_t rowValues = size_t(desc.width) * (desc.bytesPerTexel / sizeof(float));
+	for (size_t row = 0; row < valueCount; row += rowValues)
+	{
+		bool changed = false;
+		for (size_t i = row; i < row + rowValues; i++)
+		{
+			const float r = residentTexels[i];
+			const float limit = std::max(absoluteThreshold, relativeThreshold * std::fabs(r));
+			changed |= !(std::fabs(texels[i] - r) <= limit);
+		}
+		if (changed)
+			return true;
+	}
+	return false;
+}
+
+void LutDeltaTracker::Reset()
+{
+	desc = LutDesc();
+	resident.clear();
+	resident.shrink_to_fit();
+}
+
+const LutDeltaUpload::Table LutDeltaUpload::Tables[4] =
+{
+	{ &CpuLutSet::transmittance, &LutTextureSet::transmittance },
+	{ &CpuLutSet::directIrradiance, &LutTextureSet::directIrradiance },
+	{ &CpuLutSet::singleRayleighScattering, &LutTextureSet::singleScattering },
+	{ &CpuLutSet::multipleScattering, &LutTextureSet::multipleScattering }
+};
+
+LutDeltaUpload::LutDeltaUpload(LutTexturePool& texturePool)
+	: lutTexturePool(texturePool)
+{
+}
+
+LutDeltaUpload::~LutDeltaUpload()
+{
+	Release();
+}
+
+void LutDeltaUpload::SetThresholds(float relative, float absolute, int brickRows)
+{
+	for (LutDeltaTracker& tracker : trackers)
+	{
+		tracker.relativeThreshold = relative;
+		tracker.absoluteThreshold = absolute;
+		tracker.brickRows = brickRows;
+	}
+}
+
+LutDeltaStats LutDeltaUpload::Upload(crossplatform::RenderPlatform* renderPlatform, crossplatform::GraphicsDeviceContext& deviceContext, const CpuLutSet& luts)
+{
+	const LutDimensions& d = luts.dims;
+	const bool sameSize = textures.transmittance && d.transmittanceWidth == textures.dims.transmittanceWidth && d.transmittanceHeight == textures.dims.transmittanceHeight
+		&& d.irradianceWidth == textures.dims.irradianceWidth && d.irradianceHeight == textures.dims.irradianceHeight
+		&& d.ScatteringWidth() == textures.dims.ScatteringWidth() && d.scatteringMu == textures.dims.scatteringMu && d.scatteringR == textures.dims.scatteringR;
+	if (!sameSize)
+	{
+		Release();
+		const crossplatform::PixelFormat f = crossplatform::PixelFormat::RGBA_32_FLOAT;
+		textures.transmittance = lutTexturePool.Acquire(renderPlatform, LutTexturePool::Texture2D(d.transmittanceWidth, d.transmittanceHeight, f));
+		textures.directIrradiance = lutTexturePool.Acquire(renderPlatform, LutTexturePool::Texture2D(d.irradianceWidth, d.irradianceHeight, f));
+		textures.singleScattering = lutTexturePool.Acquire(renderPlatform, LutTexturePool::Texture3D(d.ScatteringWidth(), d.scatteringMu, d.scatteringR, f));
+		textures.multipleScattering = lutTexturePool.Acquire(renderPlatform, LutTexturePool::Texture3D(d.ScatteringWidth(), d.scatteringMu, d.scatteringR, f));
+	}
+	textures.dims = d;
+
+	LutDeltaStats stats;
+	for (int t = 0; t < 4; t++)
+	{
+		const CpuLut& lut = luts.*Tables[t].lut;
+		crossplatform::Texture* texture = textures.*Tables[t].texture;
+		stats += trackers[t].Update(lut, dirty);
+		for (const LutTexelRange& range : dirty)
+			texture->setTexels(deviceContext, lut.texels + range.first * lut.Channels(), int(range.first), int(range.count));
+	}
+	return stats;
+}
+
+void LutDeltaUpload::Release()
+{
+	for (int t = 0; t < 4; t++)
+	{
+		crossplatform::Texture*& texture = textures.*Tables[t].texture;
+		if (texture)
+			lutTexturePool.Release(texture);
+		texture = nullptr;
+		trackers[t].Reset();
+	}
+}
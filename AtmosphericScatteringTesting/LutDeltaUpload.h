@@ -0,0 +1,105 @@
+#pragma once
+
+#include "CpuAtmosphereEngine.h"
+#include "LutTexturePool.h"
+#include "Platform/CrossPlatform/DeviceContext.h"
+
+#include <vector>
+
+//! A run of texels, in the order a CpuLut stores them, that must be sent to the GPU.
+struct LutTexelRange
+{
+	size_t first = 0;
+	size_t count = 0;
+};
+
+//! What one delta update sent and what it could skip.
+struct LutDeltaStats
+{
+	size_t brickCount = 0;
+	size_t dirtyBrickCount = 0;
+	size_t uploadedBytes = 0;
+	size_t totalBytes = 0;		// What a full upload would have sent.
+
+	double SkippedFraction() const
+	{
+		return brickCount ? double(brickCount - dirtyBrickCount) / double(brickCount) : 0.0;
+	}
+	LutDeltaStats& operator+=(const LutDeltaStats& s)
+	{
+		brickCount += s.brickCount;
+		dirtyBrickCount += s.dirtyBrickCount;
+		uploadedBytes += s.uploadedBytes;
+		totalBytes += s.totalBytes;
+		return *this;
+	}
+};
+
+//! Keeps a CPU copy of what is resident in one GPU LUT. Given a newly baked version of the table, it
+//! finds the bricks in which some texel differs from the resident one by more than the threshold,
+//! and returns them as a short list of texel ranges to upload. A brick is brickRows whole rows of
+//! one slice, so that it is contiguous in both the CpuLut and the texture, and adjacent dirty bricks
+//! merge into one range. Skipped bricks keep their resident values, so small changes can't add up
+//! over many updates without ever being sent.
+class LutDeltaTracker
+{
+public:
+	int brickRows = 8;
+	//! A texel channel is changed if it differs by more than relativeThreshold of the resident value,
+	//! or by absoluteThreshold when that is larger. The defaults are half an fp16 ulp for normal
+	//! values and half the spacing of fp16 subnormals, so a skipped brick would round to about the
+	//! same halfs as the resident one. They assume a consumer that only needs fp16 precision: the
+	//! textures are RGBA_32_FLOAT, so a skipped brick keeps fp32 values that may differ from a full
+	//! upload by up to the threshold. Tighten them for a consumer that needs full fp32.
+	float relativeThreshold = 1.f / 2048.f;
+	float absoluteThreshold = 1.f / 33554432.f;
+
+	//! Makes lut resident, and sets dirty to the ranges that changed. If lut differs in size from the
+	//! resident table, or nothing is resident yet, the whole table is dirty.
+	LutDeltaStats Update(const CpuLut& lut, std::vector<LutTexelRange>& dirty);
+	//! Forgets the resident table, so that the next Update() sends everything.
+	void Reset();
+
+private:
+	bool IsBrickChanged(const float* texels, const float* resident, size_t valueCount) const;
+
+	LutDesc desc;
+	std::vector<float> resident;
+};
+
+//! Textures kept up to date from successive CPU bakes by sending only the bricks that changed.
+//! Must only be used from the render thread. Bricks go up as partial setTexels() ranges, like
+//! ProgressiveBake's rows, with the same caveat: that path is unverified on D3D12.
+class LutDeltaUpload
+{
+public:
+	//! The pool must outlive the LutDeltaUpload.
+	explicit LutDeltaUpload(LutTexturePool& texturePool);
+	~LutDeltaUpload();
+
+	//! Brings the textures up to date with luts, which must have RGBA texels.
+	LutDeltaStats Upload(simul::crossplatform::RenderPlatform* renderPlatform, simul::crossplatform::GraphicsDeviceContext& deviceContext, const CpuLutSet& luts);
+	//! Null until the first Upload().
+	const LutTextureSet* GetTextures() const
+	{
+		return textures.transmittance ? &textures : nullptr;
+	}
+	//! The thresholds and brick size, as in LutDeltaTracker, apply from the next Upload(). Set from
+	//! the delta_threshold, delta_absolute_threshold and delta_brick_rows command-line values.
+	void SetThresholds(float relative, float absolute, int brickRows);
+	//! Returns the textures to the pool; the next Upload() sends everything.
+	void Release();
+
+private:
+	struct Table
+	{
+		CpuLut CpuLutSet::* lut;
+		simul::crossplatform::Texture* LutTextureSet::* texture;
+	};
+	static const Table Tables[4];
+
+	LutTexturePool& lutTexturePool;
+	LutTextureSet textures;
+	LutDeltaTracker trackers[4];
+	std::vector<LutTexelRange> dirty;
+};
@@ -0,0 +1,99 @@
+#include "LutTexturePool.h"
+
+using namespace simul;
+
+static int BytesPerTexel(crossplatform::PixelFormat f)
+{
+	switch (f)
+	{
+	case crossplatform::PixelFormat::RGBA_16_FLOAT:
+		return 8;
+	case crossplatform::PixelFormat::R_32_FLOAT:
+		return 4;
+	case crossplatform::PixelFormat::RGBA_32_FLOAT:
+	default:
+		return 16;
+	}
+}
+
+LutTexturePool::~LutTexturePool()
+{
+	InvalidateDeviceObjects();
+}
+
+LutTextureDesc LutTexturePool::Texture2D(int w, int h, crossplatform::PixelFormat f)
+{
+	LutTextureDesc desc;
+	desc.size.width = w;
+	desc.size.height = h;
+	desc.size.depth = 1;
+	desc.size.bytesPerTexel = BytesPerTexel(f);
+	desc.format = f;
+	desc.renderTarget = true;
+	return desc;
+}
+
+LutTextureDesc LutTexturePool::Texture3D(int w, int h, int d, crossplatform::PixelFormat f)
+{
+	LutTextureDesc desc;
+	desc.size.width = w;
+	desc.size.height = h;
+	desc.size.depth = d;
+	desc.size.bytesPerTexel = BytesPerTexel(f);
+	desc.format = f;
+	desc.computable = true;
+	return desc;
+}
+
+crossplatform::Texture* LutTexturePool::Acquire(crossplatform::RenderPlatform* renderPlatform, const LutTextureDesc& desc)
+{
+	stats.acquireCount++;
+	crossplatform::Texture* texture = nullptr;
+	auto i = freeTextures.find(desc);
+	if (i != freeTextures.end())
+	{
+		texture = i->second;
+		freeTextures.erase(i);
+		stats.reuseCount++;
+	}
+	else
+	{
+		texture = renderPlatform->CreateTexture();
+		if (desc.size.depth > 1)
+			texture->ensureTexture3DSizeAndFormat(renderPlatform, desc.size.width, desc.size.height, desc.size.depth, desc.format, desc.computable, 1, desc.renderTarget);
+		else
+			texture->ensureTexture2DSizeAndFormat(renderPlatform, desc.size.width, desc.size.height, 1, desc.format, desc.computable, desc.renderTarget, false, 1, 0, false, vec4(0.0, 0.0, 0.0, 0.0));
+		stats.allocationCount++;
+		stats.currentBytes += desc.size.ByteSize();
+		if (stats.currentBytes > stats.highWaterBytes)
+			stats.highWaterBytes = stats.currentBytes;
+	}
+	usedTextures[texture] = desc;
+	return texture;
+}
+
+void LutTexturePool::Release(crossplatform::Texture* texture)
+{
+	auto i = usedTextures.find(texture);
+	if (i == usedTextures.end())
+		return;
+	freeTextures.insert({ i->second, texture });
+	usedTextures.erase(i);
+}
+
+void LutTexturePool::InvalidateDeviceObjects()
+{
+	for (auto& i : freeTextures)
+	{
+		i.second->InvalidateDeviceObjects();
+		delete i.second;
+	}
+	for (auto& i : usedTextures)
+	{
+		i.first->InvalidateDeviceObjects();
+		delete i.first;
+	}
+	freeTextures.clear();
+	usedTextures.clear();
+	stats.currentBytes = 0;
+}
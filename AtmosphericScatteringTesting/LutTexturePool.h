@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Platform/CrossPlatform/RenderPlatform.h"
+#include "Platform/CrossPlatform/Texture.h"
+#include "AtmosphereParameters.h"
+#include "LutBufferPool.h"
+
+#include <map>
+
+//! Format, size and usage of a LUT texture. Textures are only reused for an identical key.
+struct LutTextureDesc
+{
+	LutDesc size;
+	simul::crossplatform::PixelFormat format = simul::crossplatform::PixelFormat::RGBA_32_FLOAT;
+	bool computable = false;	// 3D LUTs are written by compute shaders.
+	bool renderTarget = false;	// 2D LUTs are written by a full-screen quad.
+
+	bool operator<(const LutTextureDesc& d) const
+	{
+		if (!(size == d.size))
+			return size < d.size;
+		if (format != d.format)
+			return format < d.format;
+		if (computable != d.computable)
+			return computable < d.computable;
+		return renderTarget < d.renderTarget;
+	}
+};
+
+//! GPU-side counterpart of LutBufferPool: keeps released LUT textures keyed by format and
+//! dimensions so that re-bakes don't recreate device resources.
+//! Must only be used from the render thread.
+class LutTexturePool
+{
+public:
+	~LutTexturePool();
+
+	static LutTextureDesc Texture2D(int w, int h, simul::crossplatform::PixelFormat f);
+	static LutTextureDesc Texture3D(int w, int h, int d, simul::crossplatform::PixelFormat f);
+
+	simul::crossplatform::Texture* Acquire(simul::crossplatform::RenderPlatform* renderPlatform, const LutTextureDesc& desc);
+	void Release(simul::crossplatform::Texture* texture);
+	//! Deletes every texture, in use or idle. Call from OnLostDevice.
+	void InvalidateDeviceObjects();
+	LutPoolStats GetStats() const
+	{
+		return stats;
+	}
+
+private:
+	std::multimap<LutTextureDesc, simul::crossplatform::Texture*> freeTextures;
+	std::map<simul::crossplatform::Texture*, LutTextureDesc> usedTextures;
+	LutPoolStats stats;
+};
+
+//! The textures Test_External samples, all at one resolution.
+struct LutTextureSet
+{
+	LutDimensions dims;
+	simul::crossplatform::Texture* transmittance = nullptr;
+	simul::crossplatform::Texture* directIrradiance = nullptr;
+	simul::crossplatform::Texture* singleScattering = nullptr;		// Rayleigh only, as precompute_single_scattering writes it.
+	simul::crossplatform::Texture* multipleScattering = nullptr;
+};
@@ -0,0 +1,182 @@
+#include "MappingBenchmark.h"
+#include "AtmosphereParameters.h"
+#include "CpuAtmosphereEngine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+//! The CPU engine's table mappings as they were before MakeDerivedConstants(): every term that
+//! depends only on the atmosphere and the table sizes is recomputed for each sample. Kept as the
+//! baseline for RunMappingBenchmark().
+class PerSampleMapping
+{
+public:
+	PerSampleMapping(const AtmosphereParameters& p, const LutDimensions& d)
+		: params(p), dims(d)
+	{
+	}
+
+	void GetTransmittanceTextureUvFromRMu(float r, float mu, float& u, float& v) const
+	{
+		float H = std::sqrt(params.topRadius * params.topRadius - params.bottomRadius * params.bottomRadius);
+		float rho = SafeSqrt(r * r - params.bottomRadius * params.bottomRadius);
+		float d = DistanceToTopAtmosphereBoundary(r, mu);
+		float d_min = params.topRadius - r;
+		float d_max = rho + H;
+		float x_mu = (d - d_min) / (d_max - d_min);
+		float x_r = rho / H;
+		u = GetTextureCoordFromUnitRange(x_mu, dims.transmittanceWidth);
+		v = GetTextureCoordFromUnitRange(x_r, dims.transmittanceHeight);
+	}
+
+	void GetScatteringTextureUvwzFromRMuMuSNu(float r, float mu, float mu_s, float nu, bool ray_r_mu_intersects_ground, float uvwz[4]) const
+	{
+		float H = std::sqrt(params.topRadius * params.topRadius - params.bottomRadius * params.bottomRadius);
+		float rho = SafeSqrt(r * r - params.bottomRadius * params.bottomRadius);
+		float u_r = GetTextureCoordFromUnitRange(rho / H, dims.scatteringR);
+
+		float r_mu = r * mu;
+		float discriminant = r_mu * r_mu - r * r + params.bottomRadius * params.bottomRadius;
+		float u_mu;
+		if (ray_r_mu_intersects_ground)
+		{
+			float d = -r_mu - SafeSqrt(discriminant);
+			float d_min = r - params.bottomRadius;
+			float d_max = rho;
+			u_mu = 0.5f - 0.5f * GetTextureCoordFromUnitRange(d_max == d_min ? 0.f : (d - d_min) / (d_max - d_min), dims.scatteringMu / 2);
+		}
+		else
+		{
+			float d = -r_mu + SafeSqrt(discriminant + H * H);
+			float d_min = params.topRadius - r;
+			float d_max = rho + H;
+			u_mu = 0.5f + 0.5f * GetTextureCoordFromUnitRange((d - d_min) / (d_max - d_min), dims.scatteringMu / 2);
+		}
+
+		float d = DistanceToTopAtmosphereBoundary(params.bottomRadius, mu_s);
+		float d_min = params.topRadius - params.bottomRadius;
+		float d_max = H;
+		float a = (d - d_min) / (d_max - d_min);
+		float D = DistanceToTopAtmosphereBoundary(params.bottomRadius, params.mu_s_min);
+		float A = (D - d_min) / (d_max - d_min);
+		float x_mu_s = 1.f - a / A;
+		float u_mu_s = GetTextureCoordFromUnitRange(std::max(0.f, x_mu_s) / (1.f + a), dims.scatteringMuS);
+
+		uvwz[0] = (nu + 1.f) / 2.f;
+		uvwz[1] = u_mu_s;
+		uvwz[2] = u_mu;
+		uvwz[3] = u_r;
+	}
+
+	void GetRMuMuSNuFromScatteringTextureUvwz(const float uvwz[4], float& r, float& mu, float& mu_s, float& nu, bool& ray_r_mu_intersects_ground) const
+	{
+		float H = std::sqrt(params.topRadius * params.topRadius - params.bottomRadius * params.bottomRadius);
+		float rho = H * GetUnitRangeFromTextureCoord(uvwz[3], dims.scatteringR);
+		r = std::sqrt(rho * rho + params.bottomRadius * params.bottomRadius);
+
+		if (uvwz[2] < 0.5f)
+		{
+			float d_min = r - params.bottomRadius;
+			float d_max = rho;
+			float d = d_min + (d_max - d_min) * GetUnitRangeFromTextureCoord(1.f - 2.f * uvwz[2], dims.scatteringMu / 2);
+			mu = d == 0.f ? -1.f : ClampCosine(-(rho * rho + d * d) / (2.f * r * d));
+			ray_r_mu_intersects_ground = true;
+		}
+		else
+		{
+			float d_min = params.topRadius - r;
+			float d_max = rho + H;
+			float d = d_min + (d_max - d_min) * GetUnitRangeFromTextureCoord(2.f * uvwz[2] - 1.f, dims.scatteringMu / 2);
+			mu = d == 0.f ? 1.f : ClampCosine((H * H - rho * rho - d * d) / (2.f * r * d));
+			ray_r_mu_intersects_ground = false;
+		}
+
+		float x_mu_s = GetUnitRangeFromTextureCoord(uvwz[1], dims.scatteringMuS);
+		float d_min = params.topRadius - params.bottomRadius;
+		float d_max = H;
+		float D = DistanceToTopAtmosphereBoundary(params.bottomRadius, params.mu_s_min);
+		float A = (D - d_min) / (d_max - d_min);
+		float a = (A - x_mu_s * A) / (1.f + x_mu_s * A);
+		float d = d_min + std::min(a, A) * (d_max - d_min);
+		mu_s = d == 0.f ? 1.f : ClampCosine((H * H - d * d) / (2.f * params.bottomRadius * d));
+
+		nu = ClampCosine(uvwz[0] * 2.f - 1.f);
+	}
+
+private:
+	static float ClampCosine(float mu)
+	{
+		return std::max(-1.f, std::min(1.f, mu));
+	}
+	static float SafeSqrt(float a)
+	{
+		return std::sqrt(std::max(0.f, a));
+	}
+	static float GetTextureCoordFromUnitRange(float x, int texture_size)
+	{
+		return 0.5f / float(texture_size) + x * (1.f - 1.f / float(texture_size));
+	}
+	static float GetUnitRangeFromTextureCoord(float u, int texture_size)
+	{
+		return (u - 0.5f / float(texture_size)) / (1.f - 1.f / float(texture_size));
+	}
+	float DistanceToTopAtmosphereBoundary(float r, float mu) const
+	{
+		float discriminant = r * r * (mu * mu - 1.f) + params.topRadius * params.topRadius;
+		float d = -r * mu + SafeSqrt(discriminant);
+		return std::max(0.f, d);
+	}
+
+	AtmosphereParameters params;
+	LutDimensions dims;
+};
+
+//! Millions of round trips per second through mapping, from each of the scattering texture
+//! coordinates in uvwz to (r,mu,mu_s,nu) and back, plus the transmittance coordinates of (r,mu).
+template<typename Mapping> static double TimeMappingRoundTrips(const Mapping& mapping, const std::vector<float>& uvwz, int passes, float& checksum)
+{
+	const int samples = int(uvwz.size() / 4);
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int pass = 0; pass < passes; pass++)
+	{
+		for (int i = 0; i < samples; i++)
+		{
+			float r, mu, mu_s, nu, u, v, result[4];
+			bool ray_r_mu_intersects_ground;
+			mapping.GetRMuMuSNuFromScatteringTextureUvwz(&uvwz[4 * i], r, mu, mu_s, nu, ray_r_mu_intersects_ground);
+			mapping.GetScatteringTextureUvwzFromRMuMuSNu(r, mu, mu_s, nu, ray_r_mu_intersects_ground, result);
+			mapping.GetTransmittanceTextureUvFromRMu(r, mu, u, v);
+			checksum += result[0] + result[1] + result[2] + result[3] + u + v;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	return double(samples) * passes / seconds / 1e6;
+}
+
+void RunMappingBenchmark()
+{
+	const AtmosphereParameters p = MakeEarthAtmosphere();
+	const LutDimensions dims;
+	RgbAtmosphereEngine engine(p, dims);
+	PerSampleMapping baseline(p, dims);
+	const int SAMPLES = 1 << 16;
+	const int PASSES = 64;
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	std::vector<float> uvwz(SAMPLES * 4);
+	for (float& x : uvwz)
+		x = unit(rng);
+
+	// Accumulate the results so the compiler can't discard the work. Both mappings should give
+	// nearly the same checksum.
+	float baselineChecksum = 0.f, derivedChecksum = 0.f;
+	double baselineRate = TimeMappingRoundTrips(baseline, uvwz, PASSES, baselineChecksum);
+	double derivedRate = TimeMappingRoundTrips(engine, uvwz, PASSES, derivedChecksum);
+	std::cout << "Mapping round trips, per-sample terms: " << baselineRate << " M/s (checksum " << baselineChecksum << ")" << std::endl;
+	std::cout << "Mapping round trips, precomputed terms: " << derivedRate << " M/s (checksum " << derivedChecksum << "), "
+		<< derivedRate / baselineRate << "x" << std::endl;
+}
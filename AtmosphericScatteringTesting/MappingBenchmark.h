@@ -0,0 +1,6 @@
+#pragma once
+
+//! Times round trips through the CPU engine's table mappings, which read the constants precomputed
+//! by MakeDerivedConstants(), and through a per-sample baseline that recomputes them, and prints
+//! both rates.
+void RunMappingBenchmark();
@@ -0,0 +1,261 @@
+#include "ProgressiveBake.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace simul;
+
+const BakeProgress::Table ProgressiveBake::UploadedTables[4] =
+{
+	BakeProgress::TRANSMITTANCE,
+	BakeProgress::DIRECT_IRRADIANCE,
+	BakeProgress::SINGLE_RAYLEIGH_SCATTERING,
+	BakeProgress::MULTIPLE_SCATTERING
+};
+
+// Upper limit on one texture update, so that one frame's budget is not blown by a single call.
+static const size_t MaxUploadBytes = size_t(1) << 20;
+
+crossplatform::Texture* LutTextureSet::* ProgressiveBake::GetTexture(BakeProgress::Table table)
+{
+	switch (table)
+	{
+	case BakeProgress::TRANSMITTANCE:
+		return &LutTextureSet::transmittance;
+	case BakeProgress::DIRECT_IRRADIANCE:
+		return &LutTextureSet::directIrradiance;
+	case BakeProgress::SINGLE_RAYLEIGH_SCATTERING:
+		return &LutTextureSet::singleScattering;
+	case BakeProgress::MULTIPLE_SCATTERING:
+	default:
+		return &LutTextureSet::multipleScattering;
+	}
+}
+
+ProgressiveBake::ProgressiveBake(BakeScheduler& scheduler, LutTexturePool& texturePool)
+	: bakeScheduler(scheduler), lutTexturePool(texturePool)
+{
+}
+
+ProgressiveBake::~ProgressiveBake()
+{
+	Release();
+}
+
+LutDimensions ProgressiveBake::GetLevelDimensions(const LutDimensions& finalDims, int levelsBelowFinal)
+{
+	LutDimensions d = finalDims;
+	for (int i = 0; i < levelsBelowFinal; i++)
+	{
+		d.transmittanceWidth = std::max(2, d.transmittanceWidth / 2);
+		d.transmittanceHeight = std::max(2, d.transmittanceHeight / 2);
+		d.irradianceWidth = std::max(2, d.irradianceWidth / 2);
+		d.irradianceHeight = std::max(2, d.irradianceHeight / 2);
+		d.scatteringMuS = std::max(2, d.scatteringMuS / 2);
+		// Each half of the mu axis needs two texels.
+		d.scatteringMu = 2 * std::max(2, d.scatteringMu / 4);
+		d.scatteringR = std::max(2, d.scatteringR / 2);
+		d.transferWidth = std::max(2, d.transferWidth / 2);
+		d.transferHeight = std::max(2, d.transferHeight / 2);
+	}
+	return d;
+}
+
+void ProgressiveBake::Start(const AtmosphereParameters& p, const LutDimensions& finalDims, int levelCount)
+{
+	// Keep showing the best LUTs of the abandoned bake until the new one has a level ready.
+	if (current >= 0)
+	{
+		ReleaseTextures(previous);
+		previous = levels[current].textures;
+		levels[current].textures = LutTextureSet();
+	}
+	for (Level& level : levels)
+	{
+		if (level.progress)
+			level.progress->Cancel();
+		ReleaseTextures(level.textures);
+	}
+	levels.clear();
+	current = -1;
+	failed = false;
+
+	parameters = p;
+	levelCount = std::max(1, levelCount);
+	levels.resize(levelCount);
+	for (int i = 0; i < levelCount; i++)
+		levels[i].textures.dims = GetLevelDimensions(finalDims, levelCount - 1 - i);
+	startTime = std::chrono::high_resolution_clock::now();
+	timeToFirstUsable = -1.0;
+	timeToFinal = -1.0;
+	uploadedBytes = 0;
+	Submit(levels[0]);
+}
+
+void ProgressiveBake::Submit(Level& level)
+{
+	level.progress = std::make_shared<BakeProgress>();
+	level.future = bakeScheduler.Submit(parameters, level.textures.dims, SpectralMode::RGB, level.progress);
+	level.submitted = true;
+}
+
+void ProgressiveBake::CheckForFailure()
+{
+	for (size_t i = current + 1; i < levels.size() && levels[i].submitted; i++)
+	{
+		Level& level = levels[i];
+		if (level.future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			continue;
+		try
+		{
+			level.future.get();
+			continue;
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Progressive bake: level " << i << " failed: " << e.what() << std::endl;
+		}
+		catch (...)
+		{
+			std::cerr << "Progressive bake: level " << i << " failed" << std::endl;
+		}
+		// Only one level bakes at a time, so nothing finer than this one has been submitted.
+		ReleaseTextures(level.textures);
+		levels.resize(i);
+		failed = true;
+		return;
+	}
+}
+
+bool ProgressiveBake::IsUploaded(const Level& level) const
+{
+	if (level.uploaded)
+		return true;
+	if (!level.progress)
+		return false;
+	for (BakeProgress::Table t : UploadedTables)
+	{
+		if (level.uploadedUnits[t] < level.progress->GetUnitCount(t))
+			return false;
+	}
+	return true;
+}
+
+bool ProgressiveBake::Update(crossplatform::RenderPlatform* renderPlatform, crossplatform::GraphicsDeviceContext& deviceContext, double budgetMilliseconds)
+{
+	CheckForFailure();
+	if (levels.empty() || current == int(levels.size()) - 1)
+		return false;
+	typedef std::chrono::high_resolution_clock Clock;
+	const Clock::time_point deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(budgetMilliseconds));
+
+	// One level bakes at a time, so that the coarse one has every worker to itself. The next is
+	// queued as soon as the bake before it is done, without waiting for that one's upload.
+	for (size_t i = 1; i < levels.size(); i++)
+	{
+		if (levels[i].submitted)
+			continue;
+		const Level& before = levels[i - 1];
+		if (before.uploaded || before.future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+			Submit(levels[i]);
+		break;
+	}
+
+	// Upload coarsest first, in whole rows and r-slices, stopping at the first that isn't final.
+	// At least one upload goes through per frame, so a small budget still makes progress.
+	bool uploadedAny = false;
+	bool outOfTime = false;
+	for (size_t i = current + 1; i < levels.size() && !outOfTime; i++)
+	{
+		Level& level = levels[i];
+		if (!level.submitted)
+			break;
+		const CpuLutSet& luts = *level.progress->GetLuts();
+		LutTextureSet& textures = level.textures;
+		if (!textures.transmittance)
+		{
+			const LutDimensions& d = textures.dims;
+			const crossplatform::PixelFormat f = crossplatform::PixelFormat::RGBA_32_FLOAT;
+			textures.transmittance = lutTexturePool.Acquire(renderPlatform, LutTexturePool::Texture2D(d.transmittanceWidth, d.transmittanceHeight, f));
+			textures.directIrradiance = lutTexturePool.Acquire(renderPlatform, LutTexturePool::Texture2D(d.irradianceWidth, d.irradianceHeight, f));
+			textures.singleScattering = lutTexturePool.Acquire(renderPlatform, LutTexturePool::Texture3D(d.ScatteringWidth(), d.scatteringMu, d.scatteringR, f));
+			textures.multipleScattering = lutTexturePool.Acquire(renderPlatform, LutTexturePool::Texture3D(d.ScatteringWidth(), d.scatteringMu, d.scatteringR, f));
+		}
+		for (BakeProgress::Table t : UploadedTables)
+		{
+			const CpuLut& lut = luts.*BakeProgress::GetTable(t);
+			crossplatform::Texture* texture = textures.*GetTexture(t);
+			const int unitCount = level.progress->GetUnitCount(t);
+			const size_t texelsPerUnit = lut.desc.TexelCount() / size_t(unitCount);
+			const size_t bytesPerUnit = texelsPerUnit * size_t(lut.desc.bytesPerTexel);
+			int& uploadedUnits = level.uploadedUnits[t];
+			while (!outOfTime && uploadedUnits < unitCount && level.progress->IsFinished(t, uploadedUnits))
+			{
+				outOfTime = uploadedAny && Clock::now() >= deadline;
+				if (outOfTime)
+					break;
+				int end = uploadedUnits + 1;
+				while (end < unitCount && size_t(end - uploadedUnits + 1) * bytesPerUnit <= MaxUploadBytes && level.progress->IsFinished(t, end))
+					end++;
+				const size_t first = size_t(uploadedUnits) * texelsPerUnit;
+				const size_t count = size_t(end - uploadedUnits) * texelsPerUnit;
+				texture->setTexels(deviceContext, lut.texels + first * lut.Channels(), int(first), int(count));
+				uploadedBytes += count * size_t(lut.desc.bytesPerTexel);
+				uploadedUnits = end;
+				uploadedAny = true;
+			}
+		}
+	}
+
+	// Swap in the finest level that is wholly uploaded, and let everything coarser go.
+	int finest = current;
+	for (int i = current + 1; i < int(levels.size()); i++)
+	{
+		if (IsUploaded(levels[i]))
+			finest = i;
+	}
+	if (finest == current)
+		return false;
+	for (int i = 0; i < finest; i++)
+		ReleaseTextures(levels[i].textures);
+	ReleaseTextures(previous);
+	// The CPU tables of a level are not needed once it is on the GPU.
+	for (int i = 0; i <= finest; i++)
+	{
+		levels[i].uploaded = IsUploaded(levels[i]);
+		levels[i].progress.reset();
+		levels[i].future = BakeScheduler::LutSetFuture();
+	}
+	current = finest;
+	const double seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+	if (timeToFirstUsable < 0.0)
+		timeToFirstUsable = seconds;
+	if (IsFinished())
+		timeToFinal = seconds;
+	return true;
+}
+
+void ProgressiveBake::ReleaseTextures(LutTextureSet& textures)
+{
+	for (BakeProgress::Table t : UploadedTables)
+	{
+		crossplatform::Texture*& texture = textures.*GetTexture(t);
+		if (texture)
+			lutTexturePool.Release(texture);
+		texture = nullptr;
+	}
+}
+
+void ProgressiveBake::Release()
+{
+	for (Level& level : levels)
+	{
+		if (level.progress)
+			level.progress->Cancel();
+		ReleaseTextures(level.textures);
+	}
+	ReleaseTextures(previous);
+	levels.clear();
+	current = -1;
+	failed = false;
+}
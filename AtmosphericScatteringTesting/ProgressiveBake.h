@@ -0,0 +1,104 @@
+#pragma once
+
+#include "BakeScheduler.h"
+#include "LutTexturePool.h"
+#include "Platform/CrossPlatform/DeviceContext.h"
+
+#include <chrono>
+
+//! Re-bakes an atmosphere on the CPU without stalling the render thread. It bakes at a series of
+//! resolutions, coarsest first, each halving the one after it. As the bake marks rows and r-slices
+//! final they are uploaded, a few per frame within a time budget, and once a level is wholly uploaded
+//! it replaces the coarser one. A usable set of LUTs thus appears a few frames after a change and is
+//! refined over the frames that follow. Must only be used from the render thread.
+//!
+//! Rows and slices go up with Texture::setTexels() as linear texel ranges that start and end
+//! part-way through a 3D RGBA_32_FLOAT texture. That path has only been checked against a stub
+//! texture that records the ranges, not on the D3D12 backend.
+class ProgressiveBake
+{
+public:
+	//! Both must outlive the ProgressiveBake.
+	ProgressiveBake(BakeScheduler& scheduler, LutTexturePool& texturePool);
+	~ProgressiveBake();
+
+	//! Abandons any bake in progress and starts from the coarsest of levelCount levels, the last of
+	//! which is at finalDims. The abandoned bake's remaining jobs are cancelled.
+	void Start(const AtmosphereParameters& p, const LutDimensions& finalDims, int levelCount = 3);
+	//! Uploads finished rows and slices until budgetMilliseconds have passed, and swaps in each
+	//! level whose upload completes. Returns true if GetTextures() has changed.
+	bool Update(simul::crossplatform::RenderPlatform* renderPlatform, simul::crossplatform::GraphicsDeviceContext& deviceContext, double budgetMilliseconds);
+	//! The finest wholly uploaded level. Until the first level of a new bake is ready, this is the
+	//! last one of the bake before it, so that the old LUTs stay in use until the new ones can
+	//! replace them; null if there was none.
+	const LutTextureSet* GetTextures() const
+	{
+		if (current >= 0)
+			return &levels[current].textures;
+		return previous.transmittance ? &previous : nullptr;
+	}
+	bool IsFinished() const
+	{
+		return !failed && !levels.empty() && current == int(levels.size()) - 1;
+	}
+	//! True once a level's bake has failed. The levels coarser than it are still uploaded, but none
+	//! finer is baked until the next Start().
+	bool IsFailed() const
+	{
+		return failed;
+	}
+	//! Seconds from Start() until the coarsest level was usable, and until the final level was.
+	//! Negative until then.
+	double GetTimeToFirstUsable() const
+	{
+		return timeToFirstUsable;
+	}
+	double GetTimeToFinal() const
+	{
+		return timeToFinal;
+	}
+	//! Bytes uploaded since Start(), over every level.
+	size_t GetUploadedBytes() const
+	{
+		return uploadedBytes;
+	}
+	//! Returns every texture to the pool. Call before the pool's InvalidateDeviceObjects().
+	void Release();
+
+	//! Halves every axis of every table levelsBelowFinal times, keeping at least the two texels
+	//! each mapping needs per axis. The nu axis keeps its full size, since with so few slices
+	//! halving it would lose most of the variation with the angle between the view and the sun.
+	static LutDimensions GetLevelDimensions(const LutDimensions& finalDims, int levelsBelowFinal);
+
+private:
+	struct Level
+	{
+		LutTextureSet textures;
+		std::shared_ptr<BakeProgress> progress;
+		BakeScheduler::LutSetFuture future;
+		bool submitted = false;
+		bool uploaded = false;
+		int uploadedUnits[BakeProgress::TABLE_COUNT] = {};	// Units before this are on the GPU.
+	};
+	//! The tables uploaded, and the member of LutTextureSet each goes to.
+	static const BakeProgress::Table UploadedTables[4];
+	static simul::crossplatform::Texture* LutTextureSet::* GetTexture(BakeProgress::Table table);
+
+	void Submit(Level& level);
+	//! Logs the exception of the first level whose bake failed, and drops it and every finer level.
+	void CheckForFailure();
+	bool IsUploaded(const Level& level) const;
+	void ReleaseTextures(LutTextureSet& textures);
+
+	BakeScheduler& bakeScheduler;
+	LutTexturePool& lutTexturePool;
+	AtmosphereParameters parameters;
+	std::vector<Level> levels;
+	int current = -1;
+	bool failed = false;
+	LutTextureSet previous;
+	std::chrono::high_resolution_clock::time_point startTime;
+	double timeToFirstUsable = -1.0;
+	double timeToFinal = -1.0;
+	size_t uploadedBytes = 0;
+};
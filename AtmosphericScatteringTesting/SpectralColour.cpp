@@ -0,0 +1,65 @@
+#include "SpectralColour.h"
+
+#include <cmath>
+
+// Piecewise Gaussian used by the multi-lobe fit of the CIE 1931 matching functions in
+// Wyman, Sloan & Shirley, "Simple Analytic Approximations to the CIE XYZ Color Matching Functions", JCGT 2013.
+static double PiecewiseGaussian(double x, double mu, double sigma1, double sigma2)
+{
+	double t = (x - mu) / (x < mu ? sigma1 : sigma2);
+	return std::exp(-0.5 * t * t);
+}
+
+static void CieXyz(double lambda, double xyz[3])
+{
+	xyz[0] = 1.056 * PiecewiseGaussian(lambda, 599.8, 37.9, 31.0) + 0.362 * PiecewiseGaussian(lambda, 442.0, 16.0, 26.7) - 0.065 * PiecewiseGaussian(lambda, 501.1, 20.4, 26.2);
+	xyz[1] = 0.821 * PiecewiseGaussian(lambda, 568.8, 46.9, 40.5) + 0.286 * PiecewiseGaussian(lambda, 530.9, 16.3, 31.1);
+	xyz[2] = 1.217 * PiecewiseGaussian(lambda, 437.0, 11.8, 36.0) + 0.681 * PiecewiseGaussian(lambda, 459.0, 26.0, 13.8);
+}
+
+static void XyzToLinearSrgb(const double xyz[3], double rgb[3])
+{
+	rgb[0] = 3.2404542 * xyz[0] - 1.5371385 * xyz[1] - 0.4985314 * xyz[2];
+	rgb[1] = -0.9692660 * xyz[0] + 1.8760108 * xyz[1] + 0.0415560 * xyz[2];
+	rgb[2] = 0.0556434 * xyz[0] - 0.2040259 * xyz[1] + 1.0572252 * xyz[2];
+}
+
+void GetSpectralBinWavelengths(int n, float* lambdas)
+{
+	float width = (SpectralMaxWavelength - SpectralMinWavelength) / float(n);
+	for (int i = 0; i < n; i++)
+		lambdas[i] = SpectralMinWavelength + (float(i) + 0.5f) * width;
+}
+
+void GetSpectralToRgbWeights(int n, float* weights)
+{
+	// Integrate each matching function over each bin with a fine sub-sampling, so that a bin's
+	// weight doesn't depend on where its centre happens to fall on a narrow lobe.
+	const int SUB_SAMPLES = 16;
+	double width = double(SpectralMaxWavelength - SpectralMinWavelength) / double(n);
+	double white[3] = { 0.0, 0.0, 0.0 };
+	for (int i = 0; i < n; i++)
+	{
+		double binXyz[3] = { 0.0, 0.0, 0.0 };
+		for (int j = 0; j < SUB_SAMPLES; j++)
+		{
+			double lambda = SpectralMinWavelength + width * (double(i) + (double(j) + 0.5) / double(SUB_SAMPLES));
+			double xyz[3];
+			CieXyz(lambda, xyz);
+			for (int c = 0; c < 3; c++)
+				binXyz[c] += xyz[c] * width / double(SUB_SAMPLES);
+		}
+		double rgb[3];
+		XyzToLinearSrgb(binXyz, rgb);
+		for (int c = 0; c < 3; c++)
+		{
+			weights[c * n + i] = float(rgb[c]);
+			white[c] += rgb[c];
+		}
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		for (int i = 0; i < n; i++)
+			weights[c * n + i] = float(weights[c * n + i] / white[c]);
+	}
+}
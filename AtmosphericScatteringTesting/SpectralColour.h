@@ -0,0 +1,13 @@
+#pragma once
+
+//! Shortest and longest wavelengths, in nm, covered by the spectral bake.
+const float SpectralMinWavelength = 380.f;
+const float SpectralMaxWavelength = 780.f;
+
+//! Centre wavelengths in nm of n equal-width bins covering the visible range.
+void GetSpectralBinWavelengths(int n, float* lambdas);
+
+//! Weights w[3*n] taking n bin values to linear sRGB through the CIE 1931 2-degree colour matching
+//! functions, normalised so that a flat spectrum of 1 maps to RGB (1,1,1). This keeps the
+//! spectral bake on the same scale as the RGB one, whose solar irradiance is white.
+void GetSpectralToRgbWeights(int n, float* weights);
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cmath>
+
+//! N radiance or coefficient values carried together through the CPU engine. The operators are
+//! plain loops over a fixed-size array so that the compiler keeps a whole Spectrum in SIMD registers.
+template<int N> struct alignas(N % 16 == 0 ? 64 : (N % 8 == 0 ? 32 : 16)) Spectrum
+{
+	static const int Size = N;
+	float v[N];
+
+	static Spectrum Constant(float c)
+	{
+		Spectrum s;
+		for (int i = 0; i < N; i++)
+			s.v[i] = c;
+		return s;
+	}
+	static Spectrum Zero()
+	{
+		return Constant(0.f);
+	}
+	float& operator[](int i)
+	{
+		return v[i];
+	}
+	const float& operator[](int i) const
+	{
+		return v[i];
+	}
+	Spectrum& operator+=(const Spectrum& s)
+	{
+		for (int i = 0; i < N; i++)
+			v[i] += s.v[i];
+		return *this;
+	}
+	Spectrum& operator*=(float f)
+	{
+		for (int i = 0; i < N; i++)
+			v[i] *= f;
+		return *this;
+	}
+	Spectrum operator+(const Spectrum& s) const
+	{
+		Spectrum r;
+		for (int i = 0; i < N; i++)
+			r.v[i] = v[i] + s.v[i];
+		return r;
+	}
+	Spectrum operator-(const Spectrum& s) const
+	{
+		Spectrum r;
+		for (int i = 0; i < N; i++)
+			r.v[i] = v[i] - s.v[i];
+		return r;
+	}
+	Spectrum operator*(const Spectrum& s) const
+	{
+		Spectrum r;
+		for (int i = 0; i < N; i++)
+			r.v[i] = v[i] * s.v[i];
+		return r;
+	}
+	Spectrum operator*(float f) const
+	{
+		Spectrum r;
+		for (int i = 0; i < N; i++)
+			r.v[i] = v[i] * f;
+		return r;
+	}
+	//! Component-wise a/b, with 0 where b is 0 (used for transmittance ratios).
+	Spectrum SafeDivide(const Spectrum& s) const
+	{
+		Spectrum r;
+		for (int i = 0; i < N; i++)
+			r.v[i] = s.v[i] > 0.f ? v[i] / s.v[i] : 0.f;
+		return r;
+	}
+	Spectrum Min(float f) const
+	{
+		Spectrum r;
+		for (int i = 0; i < N; i++)
+			r.v[i] = v[i] < f ? v[i] : f;
+		return r;
+	}
+	Spectrum Exp() const
+	{
+		Spectrum r;
+		for (int i = 0; i < N; i++)
+			r.v[i] = std::exp(v[i]);
+		return r;
+	}
+};
+
+//! The RGB engine uses four lanes so that a texel maps directly onto an RGBA_32_FLOAT texture; lane 3 is zero.
+typedef Spectrum<4> RgbSpectrum;
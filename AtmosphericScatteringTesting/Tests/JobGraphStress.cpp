@@ -0,0 +1,57 @@
+// Stress test for JobGraph scheduling. It is not part of the Visual Studio project; from the
+// repository root, build and run it with:
+//
+//   g++ -std=c++17 -O1 -g -fsanitize=thread -pthread -IAtmosphericScatteringTesting AtmosphericScatteringTesting/Tests/JobGraphStress.cpp AtmosphericScatteringTesting/BakeScheduler.cpp AtmosphericScatteringTesting/CpuAtmosphereEngine.cpp AtmosphericScatteringTesting/AtmosphereParameters.cpp AtmosphericScatteringTesting/LutBufferPool.cpp AtmosphericScatteringTesting/SpectralColour.cpp -o job_graph_stress
+//   ./job_graph_stress
+//
+// Each graph has a few roots, each feeding many cheap dependents, so that dependents become ready
+// while Run() is still queuing roots. Every node must run exactly once and every graph must
+// finish. It exits with a non-zero status on any failure.
+
+#include "BakeScheduler.h"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+static const int GraphCount = 2000;
+static const int RootCount = 4;
+static const int DependentsPerRoot = 199;
+
+int main()
+{
+	ThreadPool pool(4);
+	long failures = 0;
+	for (int g = 0; g < GraphCount; g++)
+	{
+		std::shared_ptr<JobGraph> graph = std::make_shared<JobGraph>();
+		const int nodeCount = RootCount * (1 + DependentsPerRoot) + 1;
+		std::unique_ptr<std::atomic<int>[]> runs(new std::atomic<int>[nodeCount]);
+		for (int i = 0; i < nodeCount; i++)
+			runs[i].store(0);
+
+		std::vector<JobGraph::NodeId> leaves;
+		std::atomic<int>* counters = runs.get();
+		for (int r = 0; r < RootCount; r++)
+		{
+			const JobGraph::NodeId root = graph->AddNode("root", [counters, r]() { counters[r]++; });
+			for (int d = 0; d < DependentsPerRoot; d++)
+			{
+				const int index = RootCount + r * DependentsPerRoot + d;
+				leaves.push_back(graph->AddNode("dependent", [counters, index]() { counters[index]++; }, { root }));
+			}
+		}
+		graph->AddNode("finish", [counters, nodeCount]() { counters[nodeCount - 1]++; }, leaves);
+		graph->Run(pool);
+		graph->Wait();
+
+		for (int i = 0; i < nodeCount; i++)
+		{
+			if (runs[i].load() != 1 && failures++ < 5)
+				printf("Graph %d: node %d ran %d times\n", g, i, runs[i].load());
+		}
+	}
+	printf("%s: %d graphs of %d nodes, %ld failures\n", failures ? "FAILED" : "Passed", GraphCount, RootCount * (1 + DependentsPerRoot) + 1, failures);
+	return failures ? 1 : 0;
+}
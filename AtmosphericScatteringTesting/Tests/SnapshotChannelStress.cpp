@@ -0,0 +1,109 @@
+// Stress test for SnapshotChannel, meant to be run under ThreadSanitizer. It is not part of the
+// Visual Studio project; from the repository root, build and run it with:
+//
+//   g++ -std=c++17 -O1 -g -fsanitize=thread -pthread -IAtmosphericScatteringTesting AtmosphericScatteringTesting/Tests/SnapshotChannelStress.cpp -o snapshot_channel_stress
+//   ./snapshot_channel_stress
+//
+// Writers publish AtmosphereStates in which every field is derived from the version being
+// written and the writer's id. Readers check that each snapshot they copy out is one of those
+// states, not a mix of two, and that the versions they see never go backwards. It exits with a
+// non-zero status on any failure; ThreadSanitizer reports any data race it sees.
+
+#include "AtmosphereChannel.h"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static const int WriterCount = 2;
+static const int ReaderCount = 3;
+static const int WritesPerWriter = 100000;
+
+//! Sets every field the test checks from the state's new version and the id of the writer.
+static void Stamp(AtmosphereState& s, int writer)
+{
+	s.parametersVersion++;
+	const float v = float(s.parametersVersion % 1000000);
+	s.mu_s = v;
+	s.height = v + float(writer);
+	s.parameters.bottomRadius = v;
+	s.parameters.topRadius = v + 1.f;
+	s.parameters.rayleighScattering[0] = v;
+	s.parameters.absorptionExtinction[2] = v;
+	s.parameters.groundAlbedo = float(writer);
+	s.parameters.scatteringOrders = int(s.parametersVersion);
+}
+
+//! True if every field agrees with the one Stamp() wrote for s.parametersVersion.
+static bool IsConsistent(const AtmosphereState& s, uint64_t version)
+{
+	if (s.parametersVersion == 0)
+		return version == 0 && s.parameters.scatteringOrders == AtmosphereParameters().scatteringOrders;
+	const float v = float(s.parametersVersion % 1000000);
+	const float writer = s.parameters.groundAlbedo;
+	return version == s.parametersVersion
+		&& (writer == 0.f || writer == 1.f)
+		&& s.mu_s == v
+		&& s.height == v + writer
+		&& s.parameters.bottomRadius == v
+		&& s.parameters.topRadius == v + 1.f
+		&& s.parameters.rayleighScattering[0] == v
+		&& s.parameters.absorptionExtinction[2] == v
+		&& s.parameters.scatteringOrders == int(s.parametersVersion);
+}
+
+int main()
+{
+	AtmosphereChannel channel;
+	std::atomic<bool> writing{ true };
+	std::atomic<long> inconsistentCount{ 0 };
+	std::atomic<long> backwardsCount{ 0 };
+	std::atomic<long> readCount{ 0 };
+
+	std::vector<std::thread> readers;
+	for (int i = 0; i < ReaderCount; i++)
+	{
+		readers.emplace_back([&]()
+		{
+			uint64_t lastVersion = 0;
+			long reads = 0;
+			// Keep reading until after the last write, so that every reader sees the final state.
+			for (bool more = true; more; reads++)
+			{
+				more = writing.load(std::memory_order_acquire);
+				AtmosphereState s;
+				const uint64_t version = channel.Read(s);
+				if (!IsConsistent(s, version) && inconsistentCount++ < 5)
+					printf("Inconsistent snapshot at version %llu\n", (unsigned long long)version);
+				if (version < lastVersion && backwardsCount++ < 5)
+					printf("Version went back from %llu to %llu\n", (unsigned long long)lastVersion, (unsigned long long)version);
+				lastVersion = version;
+			}
+			readCount += reads;
+		});
+	}
+
+	std::vector<std::thread> writers;
+	for (int w = 0; w < WriterCount; w++)
+	{
+		writers.emplace_back([&channel, w]()
+		{
+			for (int i = 0; i < WritesPerWriter; i++)
+				channel.Update([w](AtmosphereState& s) { Stamp(s, w); });
+		});
+	}
+	for (std::thread& t : writers)
+		t.join();
+	writing.store(false, std::memory_order_release);
+	for (std::thread& t : readers)
+		t.join();
+
+	const uint64_t expectedVersion = uint64_t(WriterCount) * WritesPerWriter;
+	AtmosphereState last;
+	const uint64_t lastVersion = channel.Read(last);
+	const bool passed = inconsistentCount == 0 && backwardsCount == 0 && lastVersion == expectedVersion && IsConsistent(last, lastVersion);
+	printf("%s: %ld reads, %ld inconsistent, %ld going backwards, final version %llu of %llu\n", passed ? "Passed" : "FAILED",
+		readCount.load(), inconsistentCount.load(), backwardsCount.load(), (unsigned long long)lastVersion, (unsigned long long)expectedVersion);
+	return passed ? 0 : 1;
+}